@@ -0,0 +1,90 @@
+#ifndef CALL_GRAPH_H
+#define CALL_GRAPH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "Profile.h"
+
+namespace cgprofiler {
+
+
+// A weighted call graph in compressed sparse row form. Nodes are functions,
+// and the calls from every site of a caller to the same callee are merged
+// into a single edge. Edges are stored both by caller and by callee.
+struct CallGraph {
+  // String table ID of the name of each node.
+  std::vector<uint32_t> names;
+
+  // The callees of node n are outTargets[outOffsets[n] .. outOffsets[n+1]].
+  std::vector<uint64_t> outOffsets;
+  std::vector<uint32_t> outTargets;
+  std::vector<uint64_t> outWeights;
+
+  // The callers of node n are inSources[inOffsets[n] .. inOffsets[n+1]].
+  std::vector<uint64_t> inOffsets;
+  std::vector<uint32_t> inSources;
+  std::vector<uint64_t> inWeights;
+
+  size_t
+  size() const {
+    return names.size();
+  }
+
+  static CallGraph fromProfile(const Profile& profile);
+};
+
+
+// Strongly connected components of a call graph. Components are numbered in
+// reverse topological order, so every call between two different components
+// goes from a higher to a lower number.
+struct Components {
+  std::vector<uint32_t> component;
+  // The nodes of component c are members[memberOffsets[c] ..
+  // memberOffsets[c+1]].
+  std::vector<uint64_t> memberOffsets;
+  std::vector<uint32_t> members;
+
+  size_t
+  size() const {
+    return memberOffsets.size() - 1;
+  }
+};
+
+Components findComponents(const CallGraph& graph);
+
+
+// Runs body(i) for every i in [0, n), split into contiguous chunks over up to
+// the given number of threads.
+template <typename Body>
+void
+parallelFor(size_t n, unsigned threads, Body body) {
+  threads = std::max(1u, std::min<unsigned>(threads, n / 1024 + 1));
+  if (threads == 1) {
+    for (size_t i = 0; i < n; ++i) {
+      body(i);
+    }
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  size_t chunk = (n + threads - 1) / threads;
+  for (unsigned t = 0; t < threads; ++t) {
+    size_t begin = t * chunk;
+    size_t end   = std::min(n, begin + chunk);
+    workers.emplace_back([begin, end, &body] {
+      for (size_t i = begin; i < end; ++i) {
+        body(i);
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+}
+
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef MAPPED_PROFILE_H
+#define MAPPED_PROFILE_H
+
+#include <cstdint>
+
+// Layout of the profile files that the runtime maps into memory in crash
+// resilient mode. The runtime counts directly into the file, so a process
+// that dies still leaves behind every count it reached. The file holds a
+// header, an open addressed table of edges, a table of the call sites those
+// edges start from, a table of functions indexed by global function ID, and
+// a region of NUL terminated function and file names.
+
+namespace cgprofiler {
+namespace mapped {
+
+
+constexpr char MAGIC[8]  = {'C', 'G', 'P', 'R', 'O', 'F', 'M', '1'};
+constexpr uint32_t VERSION = 4;
+
+enum State : uint32_t {
+  RUNNING  = 0,
+  COMPLETE = 1,
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  // COMPLETE once the final flush at exit has happened.
+  uint32_t state;
+  // Size of an entry and of the count at its end, which depend on the
+  // counter width the runtime was built with.
+  uint32_t entrySize;
+  uint32_t counterBytes;
+  // Counts are recorded for one in every samplePeriod calls.
+  uint64_t samplePeriod;
+  // Number of entries in the edge table, always a power of two.
+  uint64_t capacity;
+  uint64_t entriesOffset;
+  // Number of entries in the site table, always a power of two.
+  uint64_t sitesCapacity;
+  uint64_t sitesOffset;
+  // Number of uint32_t name offsets in the function table.
+  uint64_t functionsCapacity;
+  uint64_t functionsOffset;
+  uint64_t stringsOffset;
+  uint64_t stringsCapacity;
+  uint64_t stringsUsed;
+  // Calls that could not be recorded because a table or the string region
+  // was full.
+  uint64_t dropped;
+};
+
+// Functions are stored as one plus their global ID, and names as one plus
+// their offset in the string region, so that zero marks an empty slot. The
+// caller of a site and the callee of an edge are written last when a slot is
+// claimed, so a crash never leaves a partially written entry behind.
+
+// A call site, stored once however many callees are reached from it.
+struct Site {
+  uint64_t siteHash;
+  uint32_t caller;
+  uint32_t filename;
+  uint32_t line;
+  uint32_t reserved;
+};
+
+// An edge from a call site to one callee. Entries are 16 bytes with 32 bit
+// counts and 24 bytes with 64 bit counts, whose count is always last.
+template <typename Count>
+struct Entry {
+  uint64_t siteHash;
+  uint32_t callee;
+  Count count;
+};
+
+constexpr uint64_t CALLEE_OFFSET = sizeof(uint64_t);
+
+constexpr uint64_t ENTRIES_OFFSET = 4096;
+}
+}
+
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <vector>
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/ErrorOr.h"
+
+namespace cgprofiler {
+
+
+// Interns the function and file names of one or more profiles so that edges
+// can be compared by integer ID. Profiles that are compared with each other
+// must share a table.
+class StringTable {
+public:
+  uint32_t intern(llvm::StringRef str);
+
+  llvm::StringRef
+  get(uint32_t id) const {
+    return strings[id];
+  }
+
+  // Returns the ID of str or NOT_FOUND if no profile mentions it.
+  uint32_t lookup(llvm::StringRef str) const;
+
+  static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+private:
+  llvm::StringMap<uint32_t> ids;
+  std::vector<llvm::StringRef> strings;
+};
+
+
+struct ProfileEdge {
+  uint32_t caller;
+  uint32_t filename;
+  uint64_t line;
+  uint32_t callee;
+  uint64_t count;
+  // Build stable identifier of the call site, or 0 for older profiles.
+  uint64_t siteHash;
+
+  bool
+  sameSite(const ProfileEdge& other) const {
+    return caller == other.caller && filename == other.filename
+           && line == other.line && callee == other.callee
+           && siteHash == other.siteHash;
+  }
+
+  bool
+  operator<(const ProfileEdge& other) const {
+    if (caller != other.caller) {
+      return caller < other.caller;
+    }
+    if (filename != other.filename) {
+      return filename < other.filename;
+    }
+    if (line != other.line) {
+      return line < other.line;
+    }
+    if (callee != other.callee) {
+      return callee < other.callee;
+    }
+    return siteHash < other.siteHash;
+  }
+};
+
+
+struct Profile {
+  std::vector<ProfileEdge> edges;
+  // False for memory mapped profiles whose program never reached its final
+  // flush, e.g. because it crashed.
+  bool complete = true;
+  // Calls the runtime could not record.
+  uint64_t dropped = 0;
+
+  uint64_t totalCalls() const;
+
+  // Sorts the edges by (caller, file, line, callee, site hash) and merges
+  // duplicates.
+  void canonicalize();
+};
+
+
+// A pair of corresponding edges from two profiles. Edges without a
+// counterpart have a null before or after.
+struct EdgeMatch {
+  const ProfileEdge* before;
+  const ProfileEdge* after;
+};
+
+
+// Matches the edges of two canonicalized profiles. Edges first match on their
+// exact site. The remaining edges with the same caller, file, and callee are
+// then paired in line order when their lines differ by at most maxLineDrift,
+// so that profiles of slightly different builds can still be compared.
+std::vector<EdgeMatch> matchProfiles(const Profile& before,
+                                     const Profile& after,
+                                     uint64_t maxLineDrift);
+
+
+// Reads a profile as printed by the runtime. Each line holds
+//   caller file line callee count [site-hash]
+// separated by whitespace or commas, with the site hash in hexadecimal. Lines
+// that do not parse, such as the banner printed before the edges, are
+// skipped. Memory mapped profiles (see MappedProfile.h) are recognized by
+// their header and may have been left unfinished by a crash.
+llvm::ErrorOr<Profile> readProfile(llvm::StringRef path, StringTable& strings);
+}
+
+
+#endif
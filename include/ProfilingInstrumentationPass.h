@@ -3,11 +3,16 @@
 #ifndef PROFILING_INSTRUMENTATION_PASS_H
 #define PROFILING_INSTRUMENTATION_PASS_H
 
+#include <string>
+#include <utility>
 #include <vector>
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/CallSite.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
@@ -15,12 +20,62 @@
 namespace cgprofiler {
 
 
+// What the pass did to a module, for judging the cost of instrumentation.
+struct InstrumentationStats {
+  uint64_t direct_sites   = 0;
+  uint64_t indirect_sites = 0;
+  // Calls that were inlined before instrumentation, counted where their
+  // bodies begin.
+  uint64_t inlined_sites = 0;
+  // Calls that are deliberately not counted, such as debug intrinsics.
+  uint64_t skipped_sites   = 0;
+  uint64_t prologues       = 0;
+  uint64_t emitted_globals = 0;
+  std::vector<std::pair<std::string, double>> phase_seconds;
+};
+
+
+// A call that was inlined before instrumentation. site is the inlinedAt
+// location shared by every instruction of the inlined body, and entries are
+// where to count each time control enters the body.
+struct InlinedCall {
+  llvm::DILocation* site;
+  llvm::DISubprogram* callee;
+  llvm::SmallVector<llvm::Instruction*, 2> entries;
+};
+
+
 struct ProfilingInstrumentationPass : public llvm::ModulePass {
   static char ID;
   llvm::DenseMap<llvm::Function*, uint64_t> fn_id_map;
   std::vector<llvm::Function*> all_fn;
+  llvm::GlobalVariable* global_ids = nullptr;
+  llvm::GlobalVariable* module_record = nullptr;
+  llvm::StringMap<llvm::Constant*> filenames;
+  llvm::StringMap<unsigned> site_occurrences;
+  InstrumentationStats stats;
+
+  // Callee counting mode: call sites publish a site descriptor through
+  // site_slot and the address they call through target_slot, and the
+  // prologue of that callee records the edge.
+  bool calleeCounting;
+  llvm::StructType* site_ty         = nullptr;
+  llvm::GlobalVariable* site_slot   = nullptr;
+  llvm::GlobalVariable* target_slot = nullptr;
 
-  ProfilingInstrumentationPass() : llvm::ModulePass(ID) {}
+  // Post-inlining mode: edges are taken from source functions, including
+  // those that were inlined and may no longer exist in the module. These
+  // receive IDs after all_fn but have no address.
+  bool afterInlining;
+  std::vector<InlinedCall> inlined_calls;
+  std::vector<llvm::StringRef> logical_fn;
+  llvm::StringMap<uint64_t> logical_ids;
+
+  explicit ProfilingInstrumentationPass(bool calleeCounting = false,
+                                        bool afterInlining  = false)
+    : llvm::ModulePass(ID),
+      calleeCounting{calleeCounting},
+      afterInlining{afterInlining} {}
 
   bool runOnModule(llvm::Module& m) override;
   void handleInstruction(llvm::Module& m,
@@ -28,6 +83,30 @@ struct ProfilingInstrumentationPass : public llvm::ModulePass {
                          llvm::Function*,
                          llvm::Value* fp_fn,
                          llvm::Value* counter);
+  void insertSiteCheck(llvm::Module& m,
+                       llvm::Instruction* before,
+                       llvm::Constant* site,
+                       llvm::Value* callee,
+                       uint64_t caller,
+                       const llvm::DebugLoc& loc,
+                       uint64_t site_hash,
+                       llvm::Value* fp_fn);
+  llvm::Constant* getFilename(llvm::Module& m, llvm::StringRef filename);
+  void handleInlinedCall(llvm::Module& m,
+                         const InlinedCall& call,
+                         llvm::Value* counter);
+  void findInlinedCalls(llvm::Function& f);
+  void addLogicalFunction(llvm::Module& m, llvm::DISubprogram* sp);
+  uint64_t getLogicalId(llvm::Module& m, llvm::DISubprogram* sp);
+  llvm::Value* loadGlobalId(llvm::IRBuilder<>& builder, uint64_t id);
+  void createSiteSlot(llvm::Module& m);
+  llvm::Constant* createSiteDescriptor(llvm::Module& m,
+                                       uint64_t caller,
+                                       const llvm::DebugLoc& loc,
+                                       uint64_t site_hash);
+  uint64_t computeSiteHash(llvm::StringRef caller,
+                           llvm::StringRef callee,
+                           const llvm::DebugLoc& loc);
 };
 }
 
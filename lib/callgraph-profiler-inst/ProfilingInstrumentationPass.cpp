@@ -1,12 +1,18 @@
 
 
+#include "llvm/ADT/SmallString.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 
 #include "ProfilingInstrumentationPass.h"
@@ -37,6 +43,13 @@ createConstantString(llvm::Module& m, llvm::StringRef str) {
   return llvm::ConstantExpr::getInBoundsGetElementPtr(arrayTy, asStr, indices);
 }
 
+static double
+secondsSince(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
 static DenseMap<Function*, uint64_t>
 cmpt_fn_ids(llvm::ArrayRef<Function*> functions) {
   DenseMap<Function*, uint64_t> id_map;
@@ -52,48 +65,136 @@ cmpt_fn_ids(llvm::ArrayRef<Function*> functions) {
   return id_map;
 }
 
-void
-create_id_addr_map(Module& m, std::vector<Function*> all_fn) {
-  auto num_fn   = all_fn.size();
+// Functions that exist only in the debug info, because every call to them was
+// inlined, have no address and come last.
+static GlobalVariable*
+create_id_addr_map(Module& m,
+                   llvm::ArrayRef<Function*> all_fn,
+                   size_t num_logical) {
+  auto num_fn   = all_fn.size() + num_logical;
   auto& context = m.getContext();
   auto* intTy   = Type::getInt64Ty(context);
   auto* tableTy = ArrayType::get(intTy, num_fn);
   std::vector<Constant*> values;
-  for (auto it = all_fn.begin(); it != all_fn.end(); it++) {
-    auto& f = *it;
-    values.push_back(f);
-    // std::cout << "entry point registered: " << f->getName().str() << std::endl;
+  for (auto f : all_fn) {
+    values.push_back(ConstantExpr::getPtrToInt(f, intTy));
   }
+  values.resize(num_fn, ConstantInt::get(intTy, 0));
 
   auto* id_addr_map = ConstantArray::get(tableTy, values);
-  new GlobalVariable(m,
-                     tableTy,
-                     false,
-                     GlobalValue::ExternalLinkage,
-                     id_addr_map,
-                     "CaLlPrOfIlEr_id_addr_map");
+  return new GlobalVariable(m,
+                            tableTy,
+                            true,
+                            GlobalValue::PrivateLinkage,
+                            id_addr_map,
+                            "CaLlPrOfIlEr_id_addr_map");
 }
 
-void
-create_fn_names(Module& m, std::vector<Function*> all_fn) {
+static GlobalVariable*
+create_fn_names(Module& m,
+                llvm::ArrayRef<Function*> all_fn,
+                llvm::ArrayRef<StringRef> logical_fn) {
   auto& context  = m.getContext();
-  auto num_fn    = all_fn.size();
+  auto num_fn    = all_fn.size() + logical_fn.size();
   auto* stringTy = Type::getInt8PtrTy(context);
   auto* tableTy  = ArrayType::get(stringTy, num_fn);
 
   std::vector<Constant*> values;
-  for (auto it = all_fn.begin(); it != all_fn.end(); it++) {
-    auto& f = *it;
+  for (auto f : all_fn) {
     values.push_back(createConstantString(m, f->getName()));
   }
+  for (auto name : logical_fn) {
+    values.push_back(createConstantString(m, name));
+  }
 
   auto* fn_names = ConstantArray::get(tableTy, values);
-  new GlobalVariable(m,
-                     tableTy,
-                     false,
-                     GlobalValue::ExternalLinkage,
-                     fn_names,
-                     "CaLlPrOfIlEr_fn_names");
+  return new GlobalVariable(m,
+                            tableTy,
+                            true,
+                            GlobalValue::PrivateLinkage,
+                            fn_names,
+                            "CaLlPrOfIlEr_fn_names");
+}
+
+// The runtime fills this table with the program wide ID of every function in
+// the module when the module registers itself. Call sites load their IDs from
+// here, so no module needs to know how many others were linked in.
+static GlobalVariable*
+create_global_ids(Module& m, size_t num_fn) {
+  auto* intTy   = Type::getInt64Ty(m.getContext());
+  auto* tableTy = ArrayType::get(intTy, num_fn);
+  return new GlobalVariable(m,
+                            tableTy,
+                            false,
+                            GlobalValue::PrivateLinkage,
+                            ConstantAggregateZero::get(tableTy),
+                            "CaLlPrOfIlEr_global_ids");
+}
+
+// Every instrumented module carries one registration record:
+//   { i64 num_fn, i8** fn_names, i64* id_addr_map, i64* global_ids }
+// A constructor in the module hands the record to CGPROF(register_module), so
+// separately instrumented objects and dlopen()ed libraries merge their
+// functions into a single ID space at startup.
+static GlobalVariable*
+create_module_record(Module& m,
+                     size_t num_fn,
+                     GlobalVariable* fn_names,
+                     GlobalVariable* id_addr_map,
+                     GlobalVariable* global_ids) {
+  auto& context  = m.getContext();
+  auto* int64Ty  = Type::getInt64Ty(context);
+  auto* stringTy = Type::getInt8PtrTy(context);
+  auto* recordTy = StructType::create(context,
+                                      {int64Ty,
+                                       stringTy->getPointerTo(),
+                                       int64Ty->getPointerTo(),
+                                       int64Ty->getPointerTo()},
+                                      "CaLlPrOfIlEr_module_record");
+
+  auto* zero = ConstantInt::get(Type::getInt32Ty(context), 0);
+  Constant* indices[] = {zero, zero};
+  auto first = [&indices](GlobalVariable* table) {
+    return ConstantExpr::getInBoundsGetElementPtr(
+        table->getValueType(), table, indices);
+  };
+
+  Constant* fields[] = {ConstantInt::get(int64Ty, num_fn, false),
+                        first(fn_names),
+                        first(id_addr_map),
+                        first(global_ids)};
+  return new GlobalVariable(m,
+                            recordTy,
+                            true,
+                            GlobalValue::PrivateLinkage,
+                            ConstantStruct::get(recordTy, fields),
+                            "CaLlPrOfIlEr_module_record");
+}
+
+// Names a source function the way the module would name its symbol.
+static StringRef
+getSubprogramName(DISubprogram* sp) {
+  auto name = sp->getLinkageName();
+  return name.empty() ? sp->getName() : name;
+}
+
+static void
+create_module_ctor(Module& m, GlobalVariable* record) {
+  auto& context   = m.getContext();
+  auto* voidTy    = Type::getVoidTy(context);
+  auto* recordPtr = record->getType();
+  auto* registerTy  = FunctionType::get(voidTy, {recordPtr}, false);
+  auto* register_fn =
+      m.getOrInsertFunction("CaLlPrOfIlEr_register_module", registerTy);
+
+  auto* ctor = Function::Create(FunctionType::get(voidTy, false),
+                                GlobalValue::InternalLinkage,
+                                "CaLlPrOfIlEr_module_ctor",
+                                &m);
+  IRBuilder<> builder(BasicBlock::Create(context, "entry", ctor));
+  builder.CreateCall(register_fn, {record});
+  builder.CreateRetVoid();
+  appendToGlobalCtors(m, ctor, 0);
 }
 
 bool
@@ -102,63 +203,423 @@ ProfilingInstrumentationPass::runOnModule(llvm::Module& m) {
   auto& context = m.getContext();
   auto* int64Ty = Type::getInt64Ty(context);
 
+  auto start       = std::chrono::steady_clock::now();
+  auto num_globals = m.global_size();
+  stats            = InstrumentationStats{};
+
   // First identify the functions we wish to track
-  std::vector<Function*> all_fn;
+  all_fn.clear();
+  filenames.clear();
+  site_occurrences.clear();
+  inlined_calls.clear();
+  logical_fn.clear();
+  logical_ids.clear();
   for (auto& f : m) {
-    if (!f.getName().startswith(StringLiteral("llvm.dbg"))) {
+    // Intrinsics are not calls in the source and have no address.
+    if (!f.isIntrinsic()) {
       all_fn.push_back(&f);
     }
   }
 
   // save analysis result
-  fn_id_map   = cmpt_fn_ids(all_fn);
-  auto num_fn = all_fn.size();
-  create_fn_names(m, all_fn);
-  create_id_addr_map(m, all_fn);
-
-  auto* num_fn_global = ConstantInt::get(int64Ty, num_fn, false);
-  new GlobalVariable(m,
-                     int64Ty,
-                     true,
-                     GlobalValue::ExternalLinkage,
-                     num_fn_global,
-                     "CaLlPrOfIlEr_num_fn");
+  fn_id_map = cmpt_fn_ids(all_fn);
+  if (afterInlining) {
+    for (auto f : all_fn) {
+      if (!f->isDeclaration()) {
+        findInlinedCalls(*f);
+      }
+    }
+    for (auto& call : inlined_calls) {
+      addLogicalFunction(m, call.site->getScope()->getSubprogram());
+      addLogicalFunction(m, call.callee);
+    }
+  }
+
+  auto num_fn       = all_fn.size() + logical_fn.size();
+  auto* fn_names    = create_fn_names(m, all_fn, logical_fn);
+  auto* id_addr_map = create_id_addr_map(m, all_fn, logical_fn.size());
+  global_ids        = create_global_ids(m, num_fn);
+  auto* record =
+      create_module_record(m, num_fn, fn_names, id_addr_map, global_ids);
 
   // register runtime fn
-  auto* voidTy  = Type::getVoidTy(context);
-  auto* init_fn = m.getOrInsertFunction("CaLlPrOfIlEr_init", voidTy, nullptr);
-  appendToGlobalCtors(m, llvm::cast<Function>(init_fn), 0);
-  auto* print_fn = m.getOrInsertFunction("CaLlPrOfIlEr_print", voidTy, nullptr);
-  appendToGlobalDtors(m, llvm::cast<Function>(print_fn), 0);
+  create_module_ctor(m, record);
+  module_record = record;
 
+  auto* voidTy   = Type::getVoidTy(context);
   auto* stringTy = Type::getInt8PtrTy(context);
   SmallVector<Type*, 4> arg_types;
   arg_types.push_back(int64Ty);
   arg_types.push_back(int64Ty);
   arg_types.push_back(int64Ty);
   arg_types.push_back(stringTy);
+  arg_types.push_back(int64Ty);
   auto* countTy  = FunctionType::get(voidTy, arg_types, false);
   auto* count_fn = m.getOrInsertFunction("CaLlPrOfIlEr_count", countTy);
   auto* fp_fn    = m.getOrInsertFunction("CaLlPrOfIlEr_handle_fp", countTy);
 
+  if (calleeCounting) {
+    createSiteSlot(m);
+  }
+  stats.phase_seconds.emplace_back("tables", secondsSince(start));
+
   // insert instructions
+  start = std::chrono::steady_clock::now();
   for (auto f : all_fn) {
     // do not change external fn
     if (f->isDeclaration()) {
       continue;
     }
 
-    // Count each function as it is called.
+    // Count each function as it is called. The call sites are gathered
+    // first, since instrumenting one may split its block.
+    std::vector<CallSite> call_sites;
     for (auto& bb : *f) {
       for (auto& i : bb) {
-        handleInstruction(m, CallSite(&i), f, fp_fn, count_fn);
+        if (CallSite cs{&i}) {
+          call_sites.push_back(cs);
+        }
       }
     }
+    for (auto cs : call_sites) {
+      handleInstruction(m, cs, f, fp_fn, count_fn);
+    }
   }
 
+  stats.phase_seconds.emplace_back("call-sites", secondsSince(start));
+
+  // Inlined calls are counted directly, since no prologue of theirs remains.
+  start = std::chrono::steady_clock::now();
+  for (auto& call : inlined_calls) {
+    handleInlinedCall(m, call, count_fn);
+  }
+  if (afterInlining) {
+    stats.phase_seconds.emplace_back("inlined-calls", secondsSince(start));
+  }
+
+  // The prologues are added last so that their calls into the runtime are not
+  // themselves treated as call sites.
+  start = std::chrono::steady_clock::now();
+  if (calleeCounting) {
+    auto* enterTy  = FunctionType::get(
+        voidTy, {module_record->getType(), int64Ty}, false);
+    auto* enter_fn = m.getOrInsertFunction("CaLlPrOfIlEr_enter", enterTy);
+    for (auto f : all_fn) {
+      if (f->isDeclaration()) {
+        continue;
+      }
+      IRBuilder<> builder(&*f->getEntryBlock().getFirstInsertionPt());
+      builder.CreateCall(enter_fn,
+                         {module_record, builder.getInt64(fn_id_map[f])});
+      stats.prologues++;
+    }
+  }
+  stats.phase_seconds.emplace_back("prologues", secondsSince(start));
+  stats.emitted_globals = m.global_size() - num_globals;
+
   return true;
 }
 
+// In callee counting mode, a call site only publishes a pointer to a constant
+// descriptor of itself in a thread local slot before the call:
+//   { i64 caller, i64 line, i8* filename, record* module, i64 site_hash }
+// along with the address it calls in a second slot. The prologue of the
+// callee then counts the edge if that address is its own, so indirect calls
+// need no address lookup and each call site costs two stores.
+void
+ProfilingInstrumentationPass::createSiteSlot(Module& m) {
+  auto& context  = m.getContext();
+  auto* int64Ty  = Type::getInt64Ty(context);
+  auto* stringTy = Type::getInt8PtrTy(context);
+  site_ty        = StructType::create(
+      context,
+      {int64Ty, int64Ty, stringTy, module_record->getType(), int64Ty},
+      "CaLlPrOfIlEr_site_descriptor");
+
+  site_slot = new GlobalVariable(m,
+                                 site_ty->getPointerTo(),
+                                 false,
+                                 GlobalValue::ExternalLinkage,
+                                 nullptr,
+                                 "CaLlPrOfIlEr_site",
+                                 nullptr,
+                                 GlobalValue::GeneralDynamicTLSModel);
+  target_slot = new GlobalVariable(m,
+                                   int64Ty,
+                                   false,
+                                   GlobalValue::ExternalLinkage,
+                                   nullptr,
+                                   "CaLlPrOfIlEr_site_target",
+                                   nullptr,
+                                   GlobalValue::GeneralDynamicTLSModel);
+}
+
+Constant*
+ProfilingInstrumentationPass::createSiteDescriptor(Module& m,
+                                                   uint64_t caller,
+                                                   const DebugLoc& loc,
+                                                   uint64_t site_hash) {
+  auto* int64Ty = Type::getInt64Ty(m.getContext());
+  Constant* fields[] = {ConstantInt::get(int64Ty, caller, false),
+                        ConstantInt::get(int64Ty, loc->getLine(), false),
+                        getFilename(m, loc->getFilename()),
+                        module_record,
+                        ConstantInt::get(int64Ty, site_hash, false)};
+  return new GlobalVariable(m,
+                            site_ty,
+                            true,
+                            GlobalValue::PrivateLinkage,
+                            ConstantStruct::get(site_ty, fields),
+                            "CaLlPrOfIlEr_site_descriptor");
+}
+
+// Call sites share one string per file name rather than emitting a new global
+// for every site, which otherwise dominates the size of large modules.
+Constant*
+ProfilingInstrumentationPass::getFilename(Module& m, StringRef filename) {
+  auto& cached = filenames[filename];
+  if (!cached) {
+    cached = createConstantString(m, filename);
+  }
+  return cached;
+}
+
+// Identifies a call site independently of the function IDs of a build, so that
+// profiles of slightly different builds can still be matched. Sites that
+// share a caller, callee, and location are told apart by their order.
+uint64_t
+ProfilingInstrumentationPass::computeSiteHash(StringRef caller,
+                                              StringRef callee,
+                                              const DebugLoc& loc) {
+  SmallString<128> key;
+  raw_svector_ostream os(key);
+  os << caller << '\0' << callee << '\0' << loc->getFilename()
+     << '\0' << loc.getLine() << ':' << loc.getCol();
+  auto occurrence = site_occurrences[key]++;
+  os << '#' << occurrence;
+
+  MD5 hasher;
+  hasher.update(key);
+  MD5::MD5Result digest;
+  hasher.final(digest);
+
+  uint64_t hash = 0;
+  for (unsigned i = 0; i < 8; ++i) {
+    hash |= uint64_t(digest[i]) << (8 * i);
+  }
+  return hash;
+}
+
+Value*
+ProfilingInstrumentationPass::loadGlobalId(IRBuilder<>& builder, uint64_t id) {
+  auto* slot = builder.CreateConstInBoundsGEP2_64(global_ids, 0, id);
+  return builder.CreateLoad(slot);
+}
+
+using SiteList = SmallVector<DILocation*, 4>;
+
+static bool
+containsSite(const SiteList& sites, DILocation* site) {
+  return std::find(sites.begin(), sites.end(), site) != sites.end();
+}
+
+// Returns the inlined calls that control is inside of when it leaves bb.
+// Blocks without located instructions pass on whatever holds on every path
+// into them. A cycle of such blocks is treated as being outside every call.
+static SiteList
+getExitSites(BasicBlock* bb,
+             DenseMap<BasicBlock*, SiteList>& exits,
+             SmallPtrSetImpl<BasicBlock*>& visiting) {
+  auto found = exits.find(bb);
+  if (found != exits.end()) {
+    return found->second;
+  }
+  SiteList sites;
+  if (!visiting.insert(bb).second) {
+    return sites;
+  }
+  bool first = true;
+  for (auto* pred : predecessors(bb)) {
+    auto incoming = getExitSites(pred, exits, visiting);
+    if (first) {
+      sites = incoming;
+    } else {
+      sites.erase(std::remove_if(sites.begin(),
+                                 sites.end(),
+                                 [&incoming](DILocation* site) {
+                                   return !containsSite(incoming, site);
+                                 }),
+                  sites.end());
+    }
+    first = false;
+  }
+  exits[bb] = sites;
+  return sites;
+}
+
+// Returns where to count the calls entered along the edge from pred to bb,
+// splitting the edge if it is critical. Edges that cannot be split, such as
+// those into landing pads, are counted where bb begins.
+static Instruction*
+getEdgeInsertionPoint(BasicBlock* pred, BasicBlock* bb) {
+  auto options = CriticalEdgeSplittingOptions().setMergeIdenticalEdges();
+  if (auto* split = SplitCriticalEdge(pred, bb, options)) {
+    return split->getTerminator();
+  }
+  if (pred->getSingleSuccessor()) {
+    return pred->getTerminator();
+  }
+  return &*bb->getFirstInsertionPt();
+}
+
+// After inlining, an inlined call leaves no call instruction behind, but each
+// instruction of the inlined body carries an inlinedAt chain leading out
+// through every call it was inlined through. The inliner gives each inlined
+// call a distinct inlinedAt location, although copies of the body made by
+// later passes share it. A call is counted each time control enters its
+// body: wherever an instruction of the body follows one outside of it in the
+// same block, and on every edge into a block that begins inside the body
+// from a block that ends outside of it. Counting on edges rather than in the
+// block keeps the back edges of loops within the body from being counted.
+void
+ProfilingInstrumentationPass::findInlinedCalls(Function& f) {
+  DenseMap<DILocation*, size_t> call_index;
+  DenseMap<BasicBlock*, SiteList> exits;
+  std::vector<std::pair<size_t, BasicBlock*>> heads;
+
+  for (auto& bb : f) {
+    SiteList previous;
+    bool located = false;
+    for (auto& i : bb) {
+      DILocation* inner = i.getDebugLoc().get();
+      if (!inner) {
+        continue;
+      }
+      SiteList sites;
+      for (auto* site = inner->getInlinedAt(); site;
+           inner = site, site = site->getInlinedAt()) {
+        auto found = call_index.find(site);
+        if (found == call_index.end()) {
+          found = call_index.insert({site, inlined_calls.size()}).first;
+          inlined_calls.push_back(
+              {site, inner->getScope()->getSubprogram(), {}});
+        }
+        sites.push_back(site);
+        if (!located && &bb != &f.getEntryBlock()) {
+          heads.emplace_back(found->second, &bb);
+        } else if (!containsSite(previous, site)) {
+          inlined_calls[found->second].entries.push_back(&i);
+        }
+      }
+      previous = std::move(sites);
+      located  = true;
+    }
+    if (located) {
+      exits[&bb] = previous;
+    }
+  }
+
+  // Whether a block is entered from outside a call is only known once every
+  // block has been scanned. Splitting an edge only adds blocks without
+  // located instructions, which pass on the sites of their predecessor.
+  for (auto& head : heads) {
+    auto& call = inlined_calls[head.first];
+    SmallPtrSet<BasicBlock*, 4> visiting;
+    SmallVector<BasicBlock*, 4> preds;
+    for (auto* pred : predecessors(head.second)) {
+      if (std::find(preds.begin(), preds.end(), pred) == preds.end()) {
+        preds.push_back(pred);
+      }
+    }
+    for (auto* pred : preds) {
+      if (!containsSite(getExitSites(pred, exits, visiting), call.site)) {
+        call.entries.push_back(getEdgeInsertionPoint(pred, head.second));
+      }
+    }
+  }
+}
+
+// Source functions are identified by name. Those that no longer exist in the
+// module receive IDs of their own, which the runtime merges by name.
+void
+ProfilingInstrumentationPass::addLogicalFunction(Module& m,
+                                                 DISubprogram* sp) {
+  auto name = getSubprogramName(sp);
+  auto* f   = m.getFunction(name);
+  if ((f && fn_id_map.count(f)) || logical_ids.count(name)) {
+    return;
+  }
+  logical_ids[name] = all_fn.size() + logical_fn.size();
+  logical_fn.push_back(name);
+}
+
+uint64_t
+ProfilingInstrumentationPass::getLogicalId(Module& m, DISubprogram* sp) {
+  auto name = getSubprogramName(sp);
+  auto* f   = m.getFunction(name);
+  if (f && fn_id_map.count(f)) {
+    return fn_id_map[f];
+  }
+  return logical_ids[name];
+}
+
+void
+ProfilingInstrumentationPass::handleInlinedCall(Module& m,
+                                                const InlinedCall& call,
+                                                Value* count_fn) {
+  if (call.entries.empty()) {
+    return;
+  }
+  stats.inlined_sites++;
+
+  auto* caller = call.site->getScope()->getSubprogram();
+  DebugLoc loc{call.site};
+  auto site_hash = computeSiteHash(
+      getSubprogramName(caller), getSubprogramName(call.callee), loc);
+  for (auto* entry : call.entries) {
+    if (isa<PHINode>(entry) || entry->isEHPad()) {
+      entry = &*entry->getParent()->getFirstInsertionPt();
+    }
+    SmallVector<Value*, 4> args;
+    IRBuilder<> builder(entry);
+    args.push_back(loadGlobalId(builder, getLogicalId(m, caller)));
+    args.push_back(loadGlobalId(builder, getLogicalId(m, call.callee)));
+    args.push_back(builder.getInt64(loc.getLine()));
+    args.push_back(getFilename(m, loc->getFilename()));
+    args.push_back(builder.getInt64(site_hash));
+    builder.CreateCall(count_fn, args);
+  }
+}
+
+// A target without a prologue, such as a library function, leaves the site of
+// an indirect call in the slot. The caller then clears the slot and counts the
+// call through handle_fp, as it would outside of callee counting mode.
+void
+ProfilingInstrumentationPass::insertSiteCheck(Module& m,
+                                              Instruction* before,
+                                              Constant* site,
+                                              Value* callee,
+                                              uint64_t caller,
+                                              const DebugLoc& loc,
+                                              uint64_t site_hash,
+                                              Value* fp_fn) {
+  IRBuilder<> builder(before);
+  auto* current  = builder.CreateLoad(site_slot);
+  auto* unused   = builder.CreateICmpEQ(current, site);
+  auto* fallback = SplitBlockAndInsertIfThen(unused, before, false);
+
+  builder.SetInsertPoint(fallback);
+  builder.CreateStore(ConstantPointerNull::get(site_ty->getPointerTo()),
+                      site_slot);
+  SmallVector<Value*, 4> args;
+  args.push_back(loadGlobalId(builder, caller));
+  args.push_back(builder.CreatePtrToInt(callee, builder.getInt64Ty()));
+  args.push_back(builder.getInt64(loc->getLine()));
+  args.push_back(getFilename(m, loc->getFilename()));
+  args.push_back(builder.getInt64(site_hash));
+  builder.CreateCall(fp_fn, args);
+}
+
 void
 ProfilingInstrumentationPass::handleInstruction(Module& m,
                                                 CallSite cs,
@@ -171,40 +632,106 @@ ProfilingInstrumentationPass::handleInstruction(Module& m,
     return;
   }
 
+  // Calls that the optimizer left without a location have no source line.
+  auto loc = instr->getDebugLoc();
+  if (!loc) {
+    stats.skipped_sites++;
+    return;
+  }
+
+  // A call within inlined code is made by the function that was inlined.
+  auto caller_id   = fn_id_map[caller];
+  auto caller_name = caller->getName();
+  if (afterInlining && loc->getInlinedAt()) {
+    auto* sp    = loc->getScope()->getSubprogram();
+    caller_id   = getLogicalId(m, sp);
+    caller_name = getSubprogramName(sp);
+  }
+
   // Check whether the called function is directly invoked
   auto ptr    = cs.getCalledValue()->stripPointerCasts();
   auto callee = dyn_cast<Function>(ptr);
-  if (!callee) {
+  if (!callee && calleeCounting) {
+    // called by ptr; the target's prologue identifies the callee.
+    stats.indirect_sites++;
+    IRBuilder<> builder(instr);
+    auto site_hash = computeSiteHash(caller_name, "<indirect>", loc);
+    auto* site     = createSiteDescriptor(m, caller_id, loc, site_hash);
+    builder.CreateStore(builder.CreatePtrToInt(ptr, builder.getInt64Ty()),
+                        target_slot);
+    builder.CreateStore(site, site_slot);
+
+    auto* invoke = dyn_cast<InvokeInst>(instr);
+    if (!invoke) {
+      insertSiteCheck(
+          m, instr->getNextNode(), site, ptr, caller_id, loc, site_hash, fp_fn);
+      return;
+    }
+    auto* normal = SplitEdge(invoke->getParent(), invoke->getNormalDest());
+    insertSiteCheck(m,
+                    &*normal->getFirstInsertionPt(),
+                    site,
+                    ptr,
+                    caller_id,
+                    loc,
+                    site_hash,
+                    fp_fn);
+    // A target that unwinds is not counted, but it must not leave the site
+    // behind for a later callback to consume.
+    auto* unwind = invoke->getUnwindDest();
+    if (unwind->getFirstInsertionPt() != unwind->end()) {
+      builder.SetInsertPoint(&*unwind->getFirstInsertionPt());
+      builder.CreateStore(ConstantPointerNull::get(site_ty->getPointerTo()),
+                          site_slot);
+    }
+    return;
+  } else if (!callee) {
     // called by ptr
+    stats.indirect_sites++;
     IRBuilder<> builder(cs.getInstruction());
     auto addr = builder.CreatePtrToInt(ptr, builder.getInt64Ty());
 
-    auto loc = instr->getDebugLoc();
     SmallVector<Value*, 4> args;
-    args.push_back(builder.getInt64(fn_id_map[caller]));
+    args.push_back(loadGlobalId(builder, caller_id));
     args.push_back(addr);
     args.push_back(builder.getInt64(loc->getLine()));
-    args.push_back(createConstantString(m, loc->getFilename()));
+    args.push_back(getFilename(m, loc->getFilename()));
+    args.push_back(
+        builder.getInt64(computeSiteHash(caller_name, "<indirect>", loc)));
     builder.CreateCall(fp_fn, args);
     return;
   } else {
     // directly called
     auto callee_name = callee->getName();
-    auto callee_id   = fn_id_map[callee];
 
-    if (callee_name.startswith(StringLiteral("llvm.dbg"))) {
-      // Blacklisted functions are not counted.
+    if (callee->isIntrinsic()) {
+      // Intrinsics, such as debug info markers, are not counted.
+      stats.skipped_sites++;
+      return;
+    }
+    stats.direct_sites++;
+
+    if (calleeCounting && !callee->isDeclaration()) {
+      // Functions defined here count themselves in their prologues.
+      IRBuilder<> builder(instr);
+      auto* site = createSiteDescriptor(
+          m, caller_id, loc, computeSiteHash(caller_name, callee_name, loc));
+      builder.CreateStore(
+          ConstantExpr::getPtrToInt(callee, builder.getInt64Ty()),
+          target_slot);
+      builder.CreateStore(site, site_slot);
       return;
     }
-    auto loc = instr->getDebugLoc();
 
     // External functions are counted at their invocation sites.
     SmallVector<Value*, 4> args;
     IRBuilder<> builder(cs.getInstruction());
-    args.push_back(builder.getInt64(fn_id_map[caller]));
-    args.push_back(builder.getInt64(callee_id));
+    args.push_back(loadGlobalId(builder, caller_id));
+    args.push_back(loadGlobalId(builder, fn_id_map[callee]));
     args.push_back(builder.getInt64(loc->getLine()));
-    args.push_back(createConstantString(m, loc->getFilename()));
+    args.push_back(getFilename(m, loc->getFilename()));
+    args.push_back(
+        builder.getInt64(computeSiteHash(caller_name, callee_name, loc)));
     builder.CreateCall(count_fn, args);
   }
 }
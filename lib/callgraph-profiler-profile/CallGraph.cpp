@@ -0,0 +1,174 @@
+
+#include <algorithm>
+#include <tuple>
+
+#include "CallGraph.h"
+
+using cgprofiler::CallGraph;
+using cgprofiler::Components;
+
+
+namespace {
+
+struct WeightedEdge {
+  uint32_t source;
+  uint32_t target;
+  uint64_t weight;
+};
+
+}  // namespace
+
+
+// Fills offsets, targets, and weights with the edges grouped into one row per
+// node. The edges must be sorted by their row.
+static void
+buildRows(size_t nodes,
+          const std::vector<WeightedEdge>& edges,
+          uint32_t WeightedEdge::*row,
+          uint32_t WeightedEdge::*column,
+          std::vector<uint64_t>& offsets,
+          std::vector<uint32_t>& targets,
+          std::vector<uint64_t>& weights) {
+  offsets.assign(nodes + 1, 0);
+  targets.reserve(edges.size());
+  weights.reserve(edges.size());
+  for (auto& edge : edges) {
+    offsets[edge.*row + 1]++;
+    targets.push_back(edge.*column);
+    weights.push_back(edge.weight);
+  }
+  for (size_t n = 0; n < nodes; ++n) {
+    offsets[n + 1] += offsets[n];
+  }
+}
+
+
+CallGraph
+CallGraph::fromProfile(const Profile& profile) {
+  CallGraph graph;
+
+  // String IDs are dense, so a flat table maps them to node numbers.
+  std::vector<uint32_t> nodeOf;
+  auto node = [&graph, &nodeOf](uint32_t name) {
+    if (name >= nodeOf.size()) {
+      nodeOf.resize(name + 1, UINT32_MAX);
+    }
+    if (nodeOf[name] == UINT32_MAX) {
+      nodeOf[name] = graph.names.size();
+      graph.names.push_back(name);
+    }
+    return nodeOf[name];
+  };
+
+  std::vector<WeightedEdge> edges;
+  edges.reserve(profile.edges.size());
+  for (auto& edge : profile.edges) {
+    edges.push_back({node(edge.caller), node(edge.callee), edge.count});
+  }
+
+  // Merge the sites of each caller and callee pair into one edge.
+  auto bySource = [](const WeightedEdge& a, const WeightedEdge& b) {
+    return std::tie(a.source, a.target) < std::tie(b.source, b.target);
+  };
+  std::sort(edges.begin(), edges.end(), bySource);
+  auto out = edges.begin();
+  for (auto it = edges.begin(); it != edges.end(); ++it) {
+    if (out != edges.begin() && (out - 1)->source == it->source
+        && (out - 1)->target == it->target) {
+      (out - 1)->weight += it->weight;
+    } else {
+      *out++ = *it;
+    }
+  }
+  edges.erase(out, edges.end());
+
+  auto nodes = graph.size();
+  buildRows(nodes,
+            edges,
+            &WeightedEdge::source,
+            &WeightedEdge::target,
+            graph.outOffsets,
+            graph.outTargets,
+            graph.outWeights);
+
+  std::sort(edges.begin(),
+            edges.end(),
+            [](const WeightedEdge& a, const WeightedEdge& b) {
+              return std::tie(a.target, a.source)
+                     < std::tie(b.target, b.source);
+            });
+  buildRows(nodes,
+            edges,
+            &WeightedEdge::target,
+            &WeightedEdge::source,
+            graph.inOffsets,
+            graph.inSources,
+            graph.inWeights);
+  return graph;
+}
+
+
+// An iterative version of Tarjan's algorithm, so that deep call chains do not
+// overflow the stack.
+Components
+cgprofiler::findComponents(const CallGraph& graph) {
+  constexpr uint32_t UNVISITED = UINT32_MAX;
+  auto nodes = graph.size();
+
+  Components result;
+  result.component.assign(nodes, UNVISITED);
+  result.memberOffsets.push_back(0);
+
+  std::vector<uint32_t> index(nodes, UNVISITED);
+  std::vector<uint32_t> lowlink(nodes, 0);
+  std::vector<uint32_t> stack;
+  // Each frame is a node and the position of the next edge to visit.
+  std::vector<std::pair<uint32_t, uint64_t>> frames;
+  uint32_t nextIndex = 0;
+
+  for (uint32_t root = 0; root < nodes; ++root) {
+    if (index[root] != UNVISITED) {
+      continue;
+    }
+    frames.emplace_back(root, graph.outOffsets[root]);
+    index[root] = lowlink[root] = nextIndex++;
+    stack.push_back(root);
+
+    while (!frames.empty()) {
+      auto& frame = frames.back();
+      auto node   = frame.first;
+      if (frame.second < graph.outOffsets[node + 1]) {
+        auto target = graph.outTargets[frame.second++];
+        if (index[target] == UNVISITED) {
+          index[target] = lowlink[target] = nextIndex++;
+          stack.push_back(target);
+          frames.emplace_back(target, graph.outOffsets[target]);
+        } else if (result.component[target] == UNVISITED) {
+          lowlink[node] = std::min(lowlink[node], index[target]);
+        }
+        continue;
+      }
+
+      frames.pop_back();
+      if (!frames.empty()) {
+        auto parent     = frames.back().first;
+        lowlink[parent] = std::min(lowlink[parent], lowlink[node]);
+      }
+      if (lowlink[node] != index[node]) {
+        continue;
+      }
+
+      uint32_t component = result.memberOffsets.size() - 1;
+      uint32_t member;
+      do {
+        member = stack.back();
+        stack.pop_back();
+        result.component[member] = component;
+        result.members.push_back(member);
+      } while (member != node);
+      result.memberOffsets.push_back(result.members.size());
+    }
+  }
+
+  return result;
+}
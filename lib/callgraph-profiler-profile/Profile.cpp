@@ -0,0 +1,298 @@
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+#include <unordered_map>
+
+#include "MappedProfile.h"
+#include "Profile.h"
+
+using namespace llvm;
+using cgprofiler::EdgeMatch;
+using cgprofiler::Profile;
+using cgprofiler::ProfileEdge;
+using cgprofiler::StringTable;
+
+
+constexpr uint32_t StringTable::NOT_FOUND;
+
+
+uint32_t
+StringTable::intern(StringRef str) {
+  auto inserted = ids.insert(std::make_pair(str, strings.size()));
+  if (inserted.second) {
+    strings.push_back(inserted.first->getKey());
+  }
+  return inserted.first->getValue();
+}
+
+
+uint32_t
+StringTable::lookup(StringRef str) const {
+  auto found = ids.find(str);
+  return found == ids.end() ? NOT_FOUND : found->getValue();
+}
+
+
+uint64_t
+Profile::totalCalls() const {
+  uint64_t total = 0;
+  for (auto& edge : edges) {
+    total += edge.count;
+  }
+  return total;
+}
+
+
+void
+Profile::canonicalize() {
+  std::sort(edges.begin(), edges.end());
+  auto out = edges.begin();
+  for (auto it = edges.begin(); it != edges.end(); ++it) {
+    if (out != edges.begin() && (out - 1)->sameSite(*it)) {
+      (out - 1)->count += it->count;
+    } else {
+      *out++ = *it;
+    }
+  }
+  edges.erase(out, edges.end());
+}
+
+
+static bool
+sameFunctionAndCallee(const ProfileEdge& a, const ProfileEdge& b) {
+  return a.caller == b.caller && a.filename == b.filename
+         && a.callee == b.callee;
+}
+
+
+// Orders edges so that those that may fuzzily match are adjacent and sorted
+// by line.
+static bool
+fuzzyOrder(const ProfileEdge* a, const ProfileEdge* b) {
+  return std::tie(a->caller, a->filename, a->callee, a->line)
+         < std::tie(b->caller, b->filename, b->callee, b->line);
+}
+
+
+static void
+matchFuzzily(std::vector<const ProfileEdge*>& before,
+             std::vector<const ProfileEdge*>& after,
+             uint64_t maxLineDrift,
+             std::vector<EdgeMatch>& matches) {
+  std::sort(before.begin(), before.end(), fuzzyOrder);
+  std::sort(after.begin(), after.end(), fuzzyOrder);
+
+  auto old  = before.begin();
+  auto next = after.begin();
+  while (old != before.end() || next != after.end()) {
+    if (next == after.end()) {
+      matches.push_back({*old++, nullptr});
+    } else if (old == before.end()) {
+      matches.push_back({nullptr, *next++});
+    } else if (!sameFunctionAndCallee(**old, **next)) {
+      if (fuzzyOrder(*old, *next)) {
+        matches.push_back({*old++, nullptr});
+      } else {
+        matches.push_back({nullptr, *next++});
+      }
+    } else {
+      auto oldLine  = (*old)->line;
+      auto nextLine = (*next)->line;
+      auto drift = oldLine < nextLine ? nextLine - oldLine : oldLine - nextLine;
+      if (drift <= maxLineDrift) {
+        matches.push_back({*old++, *next++});
+      } else if (oldLine < nextLine) {
+        matches.push_back({*old++, nullptr});
+      } else {
+        matches.push_back({nullptr, *next++});
+      }
+    }
+  }
+}
+
+
+std::vector<EdgeMatch>
+cgprofiler::matchProfiles(const Profile& before,
+                          const Profile& after,
+                          uint64_t maxLineDrift) {
+  std::vector<EdgeMatch> matches;
+  matches.reserve(std::max(before.edges.size(), after.edges.size()));
+  std::vector<const ProfileEdge*> oldUnmatched;
+  std::vector<const ProfileEdge*> nextUnmatched;
+
+  // Both edge lists are sorted, so exact matches take one merge pass.
+  auto old     = before.edges.begin();
+  auto oldEnd  = before.edges.end();
+  auto next    = after.edges.begin();
+  auto nextEnd = after.edges.end();
+  while (old != oldEnd || next != nextEnd) {
+    if (next == nextEnd || (old != oldEnd && *old < *next)) {
+      oldUnmatched.push_back(&*old++);
+    } else if (old == oldEnd || *next < *old) {
+      nextUnmatched.push_back(&*next++);
+    } else {
+      matches.push_back({&*old++, &*next++});
+    }
+  }
+
+  matchFuzzily(oldUnmatched, nextUnmatched, maxLineDrift, matches);
+  return matches;
+}
+
+
+static void
+splitFields(StringRef line, SmallVectorImpl<StringRef>& fields) {
+  static const char separators[] = ", \t\r";
+  while (true) {
+    line = line.ltrim(separators);
+    if (line.empty()) {
+      return;
+    }
+    auto end = line.find_first_of(separators);
+    fields.push_back(line.substr(0, end));
+    line = line.substr(end == StringRef::npos ? line.size() : end);
+  }
+}
+
+
+// Returns the name stored at offset (plus one) in the string region, or an
+// empty string if a crash left it out of bounds or unterminated.
+static StringRef
+mappedString(StringRef strings, uint64_t offset) {
+  if (offset == 0 || offset > strings.size()) {
+    return StringRef();
+  }
+  auto rest = strings.drop_front(offset - 1);
+  auto end  = rest.find('\0');
+  return end == StringRef::npos ? StringRef() : rest.substr(0, end);
+}
+
+
+static ErrorOr<Profile>
+readMappedProfile(StringRef data, StringTable& strings) {
+  using namespace cgprofiler::mapped;
+  auto corrupt = std::make_error_code(std::errc::illegal_byte_sequence);
+
+  Header header;
+  memcpy(&header, data.data(), sizeof(header));
+  if (header.version != VERSION || header.capacity == 0
+      || (header.counterBytes != 4 && header.counterBytes != 8)
+      || header.entrySize
+             < CALLEE_OFFSET + sizeof(uint32_t) + header.counterBytes
+      || header.entriesOffset > data.size()
+      || header.capacity > (data.size() - header.entriesOffset)
+                               / header.entrySize
+      || header.sitesOffset > data.size()
+      || header.sitesCapacity > (data.size() - header.sitesOffset)
+                                    / sizeof(Site)
+      || header.functionsOffset > data.size()
+      || header.functionsCapacity > (data.size() - header.functionsOffset)
+                                        / sizeof(uint32_t)
+      || header.stringsOffset > data.size()
+      || header.stringsCapacity > data.size() - header.stringsOffset) {
+    return corrupt;
+  }
+
+  Profile profile;
+  profile.complete = header.state == COMPLETE;
+  profile.dropped  = header.dropped * header.samplePeriod;
+  auto names = data.substr(header.stringsOffset, header.stringsCapacity);
+
+  // Returns the name of the function with the given ID plus one.
+  auto* functions = data.data() + header.functionsOffset;
+  auto function   = [&](uint32_t id) {
+    if (id == 0 || id > header.functionsCapacity) {
+      return StringRef();
+    }
+    uint32_t offset = 0;
+    memcpy(&offset, functions + (id - 1) * sizeof(offset), sizeof(offset));
+    return mappedString(names, offset);
+  };
+
+  std::unordered_map<uint64_t, Site> sites;
+  auto* rawSites = data.data() + header.sitesOffset;
+  for (uint64_t i = 0; i < header.sitesCapacity; ++i) {
+    Site site;
+    memcpy(&site, rawSites + i * sizeof(Site), sizeof(Site));
+    if (site.caller) {
+      sites[site.siteHash] = site;
+    }
+  }
+
+  auto* entries = data.data() + header.entriesOffset;
+  for (uint64_t i = 0; i < header.capacity; ++i) {
+    auto* raw         = entries + i * header.entrySize;
+    uint64_t siteHash = 0;
+    uint32_t callee   = 0;
+    uint64_t count    = 0;
+    memcpy(&siteHash, raw, sizeof(siteHash));
+    memcpy(&callee, raw + CALLEE_OFFSET, sizeof(callee));
+    memcpy(&count,
+           raw + header.entrySize - header.counterBytes,
+           header.counterBytes);
+    auto site = sites.find(siteHash);
+    if (!callee || !count || site == sites.end()) {
+      continue;
+    }
+    auto callerName = function(site->second.caller);
+    auto calleeName = function(callee);
+    auto filename   = mappedString(names, site->second.filename);
+    if (callerName.empty() || calleeName.empty() || filename.empty()) {
+      continue;
+    }
+
+    ProfileEdge edge;
+    edge.caller   = strings.intern(callerName);
+    edge.filename = strings.intern(filename);
+    edge.line     = site->second.line;
+    edge.callee   = strings.intern(calleeName);
+    edge.count    = count * header.samplePeriod;
+    edge.siteHash = siteHash;
+    profile.edges.push_back(edge);
+  }
+  return std::move(profile);
+}
+
+
+ErrorOr<Profile>
+cgprofiler::readProfile(StringRef path, StringTable& strings) {
+  auto buffer = MemoryBuffer::getFileOrSTDIN(path);
+  if (!buffer) {
+    return buffer.getError();
+  }
+
+  auto data = (*buffer)->getBuffer();
+  if (data.size() >= sizeof(mapped::Header)
+      && data.startswith(StringRef(mapped::MAGIC, sizeof(mapped::MAGIC)))) {
+    return readMappedProfile(data, strings);
+  }
+
+  Profile profile;
+  SmallVector<StringRef, 8> fields;
+  StringRef rest = data;
+  while (!rest.empty()) {
+    StringRef line;
+    std::tie(line, rest) = rest.split('\n');
+
+    fields.clear();
+    splitFields(line, fields);
+    ProfileEdge edge;
+    edge.siteHash = 0;
+    if (fields.size() < 5 || fields.size() > 6
+        || fields[2].getAsInteger(10, edge.line)
+        || fields[4].getAsInteger(10, edge.count)
+        || (fields.size() == 6 && fields[5].getAsInteger(16, edge.siteHash))) {
+      continue;
+    }
+    edge.caller   = strings.intern(fields[0]);
+    edge.filename = strings.intern(fields[1]);
+    edge.callee   = strings.intern(fields[3]);
+    profile.edges.push_back(edge);
+  }
+
+  return std::move(profile);
+}
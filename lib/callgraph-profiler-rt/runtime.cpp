@@ -1,11 +1,51 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
-#include <fstream>
-#include <map>
-#include <utility>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "MappedProfile.h"
+
+// The runtime is assembled from five policies that are fixed when it is
+// compiled, so each variant of the library counts calls with straight line
+// code. CMake builds one library per combination, selected with:
+//   CGPROF_COUNTER_BITS   32 or 64 bit counters
+//   CGPROF_ATOMIC         serialize counting across threads
+//   CGPROF_SAMPLE_PERIOD  count one call in every N, at random
+//   CGPROF_MAPPED         count into a memory mapped file (MappedProfile.h)
+//   CGPROF_COLLECT_STATS  account for the runtime's own overhead
+#ifndef CGPROF_COUNTER_BITS
+#define CGPROF_COUNTER_BITS 64
+#endif
+#ifndef CGPROF_ATOMIC
+#define CGPROF_ATOMIC 0
+#endif
+#ifndef CGPROF_SAMPLE_PERIOD
+#define CGPROF_SAMPLE_PERIOD 1
+#endif
+#ifndef CGPROF_MAPPED
+#define CGPROF_MAPPED 0
+#endif
+#ifndef CGPROF_COLLECT_STATS
+#define CGPROF_COLLECT_STATS 0
+#endif
 
 extern "C" {
 
@@ -15,163 +55,1091 @@ extern "C" {
 // e.g. CGPROF(entry) yields CaLlPrOfIlEr_entry
 #define CGPROF(X) CaLlPrOfIlEr_##X
 
-// TODO: Add your runtime library data structures and functions here.
+// Each instrumented module describes its own functions with one of these
+// records. The layout must match create_module_record() in the pass.
+struct ModuleRecord {
+  uint64_t num_fn;
+  char** fn_names;
+  uint64_t* id_addr_map;
+  uint64_t* global_ids;
+};
+
+// Describes one call site in callee counting mode. The layout must match
+// createSiteSlot() in the pass.
+struct SiteDescriptor {
+  uint64_t caller;
+  uint64_t line;
+  char* fname;
+  ModuleRecord* module;
+  uint64_t site_hash;
+};
+
+// The site most recently published by an instrumented caller on this thread,
+// and the address that it called.
+thread_local SiteDescriptor* CGPROF(site) = nullptr;
+thread_local uint64_t CGPROF(site_target) = 0;
+}
+
+
+// Nothing but the CGPROF() entry points is visible outside the runtime, so
+// that it cannot clash with the symbols of the profiled program.
+namespace {
+
+////////////////////////////////////////////////////////////////////////////
+// Counter width policies
+
+struct Counter32 {
+  using Value = uint32_t;
+};
+
+struct Counter64 {
+  using Value = uint64_t;
+};
+
+
+////////////////////////////////////////////////////////////////////////////
+// Atomicity policies. Counts of edges that are already in a table are
+// incremented in place without a lock. A Guard is only held to add an edge
+// or a function, and a SharedGuard to look up a function by address. Entries
+// that are read without a guard are published with store() and read with
+// load().
+
+struct Unsynchronized {
+  struct Guard {
+    explicit Guard(Unsynchronized&) {}
+  };
+  using SharedGuard = Guard;
+
+  template <typename T>
+  static void
+  increment(T& value) {
+    value++;
+  }
+
+  static void
+  add(uint64_t& value, uint64_t amount) {
+    value += amount;
+  }
+
+  static void
+  raise(uint64_t& value, uint64_t bound) {
+    if (value < bound) {
+      value = bound;
+    }
+  }
+
+  // The fences keep the compiler from reordering the writes to a mapped
+  // file that a crash could interrupt.
+  template <typename T>
+  static T
+  load(const T& value) {
+    T loaded = value;
+    std::atomic_signal_fence(std::memory_order_acquire);
+    return loaded;
+  }
+
+  template <typename T>
+  static void
+  store(T& value, T desired) {
+    std::atomic_signal_fence(std::memory_order_release);
+    value = desired;
+  }
+};
+
+// Threads only wait for each other while an edge or function is added, so a
+// thread that is preempted while counting does not stall the others. The
+// tables are plain memory, possibly in a mapped file, so they are updated
+// with atomic builtins rather than std::atomic members.
+struct Synchronized {
+  class Guard {
+  public:
+    explicit Guard(Synchronized& policy) : lock{policy.mutex} {}
+
+  private:
+    std::unique_lock<std::shared_timed_mutex> lock;
+  };
+
+  class SharedGuard {
+  public:
+    explicit SharedGuard(Synchronized& policy) : lock{policy.mutex} {}
+
+  private:
+    std::shared_lock<std::shared_timed_mutex> lock;
+  };
+
+  template <typename T>
+  static void
+  increment(T& value) {
+    __atomic_fetch_add(&value, 1, __ATOMIC_RELAXED);
+  }
+
+  static void
+  add(uint64_t& value, uint64_t amount) {
+    __atomic_fetch_add(&value, amount, __ATOMIC_RELAXED);
+  }
+
+  static void
+  raise(uint64_t& value, uint64_t bound) {
+    auto current = __atomic_load_n(&value, __ATOMIC_RELAXED);
+    while (current < bound
+           && !__atomic_compare_exchange_n(&value,
+                                           &current,
+                                           bound,
+                                           true,
+                                           __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED)) {
+    }
+  }
+
+  template <typename T>
+  static T
+  load(const T& value) {
+    return __atomic_load_n(&value, __ATOMIC_ACQUIRE);
+  }
+
+  template <typename T>
+  static void
+  store(T& value, T desired) {
+    __atomic_store_n(&value, desired, __ATOMIC_RELEASE);
+  }
+
+  std::shared_timed_mutex mutex;
+};
+
+
+////////////////////////////////////////////////////////////////////////////
+// Sampling policies
+
+struct EveryCall {
+  static constexpr uint64_t PERIOD = 1;
+
+  static bool
+  sample() {
+    return true;
+  }
+};
+
+// Counts one call in every Period on average. The gaps between recorded calls
+// are drawn at random from a geometric distribution, so that the sample does
+// not alias with calls that repeat with a period of their own, while the
+// common path stays a single decrement and test.
+template <uint64_t Period>
+struct RandomSampling {
+  static constexpr uint64_t PERIOD = Period;
+
+  static bool
+  sample() {
+    if (--countdown() > 0) {
+      return false;
+    }
+    // The countdown of a new thread starts at zero and goes negative on its
+    // first call, which draws a gap and is then sampled like any other.
+    bool due    = countdown() == 0;
+    countdown() = next_gap();
+    return due || sample();
+  }
 
-extern char* CGPROF(fn_names)[];
-extern uint64_t CGPROF(id_addr_map)[];
-extern uint64_t CGPROF(num_fn);
+private:
+  static int64_t&
+  countdown() {
+    static thread_local int64_t remaining = 0;
+    return remaining;
+  }
 
-class CallInfo {
+  static int64_t
+  next_gap() {
+    static thread_local uint64_t state = 0;
+    if (!state) {
+      state = reinterpret_cast<uint64_t>(&state) ^ uint64_t(time(nullptr));
+      state = (state ^ (state >> 31)) * 0x9e3779b97f4a7c15ULL | 1;
+    }
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    // A uniform value in (0, 1] from the top 53 bits.
+    double uniform = double((state >> 11) + 1) / double(1ULL << 53);
+    return 1 + int64_t(std::log(uniform) / std::log1p(-1.0 / Period));
+  }
+};
+
+
+////////////////////////////////////////////////////////////////////////////
+// Stats policies. Calls into the runtime are counted on entry, before the
+// sampling policy looks at them. Everything else only accounts for the calls
+// that are recorded, and updates go through the atomicity policy.
+
+// Entries into each runtime call. Every thread counts into its own block, so
+// that counting them needs neither a lock nor an atomic increment even when
+// the sampling policy skips the call.
+struct EntryCounts {
+  uint64_t count     = 0;
+  uint64_t handle_fp = 0;
+  uint64_t enter     = 0;
+};
+
+using EntryField = uint64_t EntryCounts::*;
+
+struct RuntimeStats {
+  uint64_t recorded_count_calls     = 0;
+  uint64_t recorded_handle_fp_calls = 0;
+  uint64_t recorded_enter_calls     = 0;
+  uint64_t unknown_fp_calls    = 0;
+  uint64_t fp_probes           = 0;
+  uint64_t fp_max_probe        = 0;
+  uint64_t table_probes        = 0;
+  uint64_t table_max_probe     = 0;
+  uint64_t counter_inserts     = 0;
+  uint64_t counter_growths     = 0;
+  uint64_t addr_table_rehashes = 0;
+  uint64_t timed_calls         = 0;
+  uint64_t timed_ns            = 0;
+  uint64_t ticks               = 0;
+};
+
+using StatField = uint64_t RuntimeStats::*;
+
+struct NoStats {
+  static constexpr bool ENABLED = false;
+
+  struct Timer {
+    explicit Timer(NoStats&) {}
+  };
+
+  void
+  entered(EntryField) {}
+
+  void
+  add(StatField, uint64_t = 1) {}
+
+  void
+  probe(uint64_t, StatField, StatField) {}
+
+  void
+  write(uint64_t, uint64_t) {}
+};
+
+// Writes the totals as JSON at exit, to the file named by CGPROF_STATS. By
+// default that is the profile named by CGPROF_MMAP with a .stats.json suffix,
+// or callgraph-profile.stats.json when the profile is not mapped.
+template <typename Atomicity>
+class CollectStats {
 public:
+  static constexpr bool ENABLED = true;
+
+  // Only one in every TIMER_PERIOD recorded calls is timed, since reading
+  // the clock costs about as much as the call itself.
+  static constexpr uint64_t TIMER_PERIOD = 64;
+
+  class Timer {
+  public:
+    explicit Timer(CollectStats& policy) : totals{policy.totals}, start{0} {
+      if (Atomicity::load(totals.ticks) % TIMER_PERIOD == 0) {
+        start = now_ns();
+      }
+      Atomicity::add(totals.ticks, 1);
+    }
+
+    ~Timer() {
+      if (start) {
+        Atomicity::add(totals.timed_calls, 1);
+        Atomicity::add(totals.timed_ns, now_ns() - start);
+      }
+    }
+
+  private:
+    RuntimeStats& totals;
+    uint64_t start;
+  };
+
+  void
+  entered(EntryField field) {
+    static thread_local EntryCounts* counts = nullptr;
+    if (!counts) {
+      counts = add_thread();
+    }
+    // Only this thread writes the block. The store is atomic so that reading
+    // the totals at exit does not race with threads that are still running.
+    auto& total = counts->*field;
+    __atomic_store_n(&total, total + 1, __ATOMIC_RELAXED);
+  }
+
+  void
+  add(StatField field, uint64_t amount = 1) {
+    Atomicity::add(totals.*field, amount);
+  }
+
+  void
+  probe(uint64_t probes, StatField total, StatField max) {
+    Atomicity::add(totals.*total, probes);
+    Atomicity::raise(totals.*max, probes);
+  }
+
+  void
+  write(uint64_t functions, uint64_t sample_period) {
+    std::string path = "callgraph-profile.stats.json";
+    if (const char* requested = getenv("CGPROF_STATS")) {
+      path = requested;
+    } else if (const char* profile = getenv("CGPROF_MMAP")) {
+      path = std::string{profile} + ".stats.json";
+    }
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) {
+      fprintf(stderr, "callgraph-profiler: unable to write %s\n", path.c_str());
+      return;
+    }
+
+    EntryCounts entries;
+    {
+      std::lock_guard<std::mutex> lock{threads_mutex};
+      for (auto& counts : threads) {
+        entries.count     += __atomic_load_n(&counts->count, __ATOMIC_RELAXED);
+        entries.handle_fp += __atomic_load_n(&counts->handle_fp, __ATOMIC_RELAXED);
+        entries.enter     += __atomic_load_n(&counts->enter, __ATOMIC_RELAXED);
+      }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    auto fp_lookups   = totals.recorded_handle_fp_calls;
+    auto estimated_ns = totals.timed_ns * TIMER_PERIOD;
+    fprintf(out,
+            "{\n"
+            "  \"count_calls\": %lu,\n"
+            "  \"handle_fp_calls\": %lu,\n"
+            "  \"enter_calls\": %lu,\n"
+            "  \"recorded_count_calls\": %lu,\n"
+            "  \"recorded_handle_fp_calls\": %lu,\n"
+            "  \"recorded_enter_calls\": %lu,\n"
+            "  \"unknown_fp_calls\": %lu,\n"
+            "  \"fp_lookup_mean_probes\": %.3f,\n"
+            "  \"fp_lookup_max_probes\": %lu,\n"
+            "  \"table_probes\": %lu,\n"
+            "  \"table_max_probes\": %lu,\n"
+            "  \"counter_inserts\": %lu,\n"
+            "  \"counter_table_growths\": %lu,\n"
+            "  \"addr_table_rehashes\": %lu,\n"
+            "  \"functions\": %lu,\n"
+            "  \"sample_period\": %lu,\n"
+            "  \"timed_calls\": %lu,\n"
+            "  \"timed_ns\": %lu,\n"
+            "  \"estimated_runtime_ns\": %lu,\n"
+            "  \"peak_rss_kb\": %ld\n"
+            "}\n",
+            entries.count,
+            entries.handle_fp,
+            entries.enter,
+            totals.recorded_count_calls,
+            totals.recorded_handle_fp_calls,
+            totals.recorded_enter_calls,
+            totals.unknown_fp_calls,
+            fp_lookups ? double(totals.fp_probes) / fp_lookups : 0.0,
+            totals.fp_max_probe,
+            totals.table_probes,
+            totals.table_max_probe,
+            totals.counter_inserts,
+            totals.counter_growths,
+            totals.addr_table_rehashes,
+            functions,
+            sample_period,
+            totals.timed_calls,
+            totals.timed_ns,
+            estimated_ns,
+            usage.ru_maxrss);
+    fclose(out);
+  }
+
+private:
+  static uint64_t
+  now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  // Blocks are kept until exit, since a thread's block must outlive it for
+  // its entries to be reported.
+  EntryCounts*
+  add_thread() {
+    std::lock_guard<std::mutex> lock{threads_mutex};
+    threads.emplace_back(new EntryCounts);
+    return threads.back().get();
+  }
+
+  RuntimeStats totals;
+  std::mutex threads_mutex;
+  std::vector<std::unique_ptr<EntryCounts>> threads;
+};
+
+
+////////////////////////////////////////////////////////////////////////////
+// Storage policies. Both count edges in open addressed tables keyed on the
+// site hash and callee alone. The rest of a site is only looked at when the
+// site is first seen, and its file name is copied then, so that nothing
+// refers to the memory of a module that may later be unloaded.
+
+// A call as reported by the instrumentation. Caller and callee are global
+// function IDs.
+struct CallKey {
   uint64_t caller;
   uint64_t callee;
   uint64_t line;
-  std::string fname;
-  bool
-  operator==(const struct CallInfo& other) const {
-    if (this->caller == other.caller && this->callee == other.callee
-        && this->line == other.line
-        && this->fname == other.fname) {
-      return true;
+  const char* fname;
+  uint64_t site_hash;
+};
+
+static uint64_t
+hash_parts(std::initializer_list<uint64_t> parts) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (auto part : parts) {
+    hash = (hash ^ part) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Counts in memory and prints them when the program exits. Edges live in
+// cells that never move, and an open addressed index of the cells is rebuilt
+// when it fills up. Threads that are still probing an older index find the
+// same cells there, so no count is lost while the index grows.
+template <typename Counter, typename Atomicity, typename Stats>
+class HeapTable {
+public:
+  HeapTable(uint64_t, Stats& stats) : stats{stats}, used{0} {
+    indexes.emplace_back(new Index(1024));
+    index = indexes.back().get();
+  }
+
+  void
+  add_function(const char*) {}
+
+  void
+  record(const CallKey& key) {
+    uint64_t probes = 0;
+    auto** slot     = find(*Atomicity::load(index), key, probes);
+    stats.probe(
+        probes, &RuntimeStats::table_probes, &RuntimeStats::table_max_probe);
+    if (auto* cell = Atomicity::load(*slot)) {
+      Atomicity::increment(cell->count);
+      return;
     }
-    return false;
+    insert(key);
   }
 
-  bool
-  operator==(struct CallInfo& other) {
-    if (this->caller == other.caller && this->callee == other.callee
-        && this->line == other.line
-        && this->fname == other.fname) {
-      return true;
+  void
+  close(const std::vector<std::string>& fn_names, uint64_t scale) {
+    typename Atomicity::Guard guard{atomicity};
+    struct Row {
+      uint64_t caller;
+      uint64_t callee;
+      uint64_t line;
+      const std::string* file;
+      uint64_t site_hash;
+      uint64_t count;
+    };
+    std::vector<Row> rows;
+    for (auto& cell : cells) {
+      auto& site = sites[cell.site_hash];
+      rows.push_back({site.caller,
+                      cell.callee,
+                      site.line,
+                      &files[site.file],
+                      cell.site_hash,
+                      Atomicity::load(cell.count)});
+    }
+    std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+      return std::tie(a.caller, a.callee, a.line, *a.file, a.site_hash)
+             < std::tie(b.caller, b.callee, b.line, *b.file, b.site_hash);
+    });
+
+    printf("=====================\n"
+           "Function Calls\n"
+           "=====================\n");
+    for (auto& row : rows) {
+      printf("%s %s %lu %s %lu %016lx\n",
+             fn_names[row.caller].c_str(),
+             row.file->c_str(),
+             row.line,
+             fn_names[row.callee].c_str(),
+             row.count * scale,
+             row.site_hash);
     }
-    return false;
   }
 
-  bool
-  operator<(struct CallInfo& other) {
-    if (this->caller < other.caller) {
-      return true;
+private:
+  // 16 bytes with 32 bit counters and 24 bytes with 64 bit counters.
+  struct Cell {
+    uint64_t site_hash;
+    uint32_t callee;
+    typename Counter::Value count;
+  };
+
+  struct Site {
+    uint32_t caller;
+    uint32_t line;
+    uint32_t file;
+  };
+
+  using Index = std::vector<Cell*>;
+
+  // Returns the slot holding the edge, or the empty slot where it belongs.
+  Cell**
+  find(Index& slots, const CallKey& key, uint64_t& probes) {
+    auto mask = slots.size() - 1;
+    auto hash = hash_parts({key.site_hash, key.callee});
+    for (probes = 1;; probes++) {
+      auto& slot = slots[(hash + probes - 1) & mask];
+      auto* cell = Atomicity::load(slot);
+      if (!cell
+          || (cell->callee == key.callee && cell->site_hash == key.site_hash)) {
+        return &slot;
+      }
     }
-    if (this->caller > other.caller) {
-      return false;
+  }
+
+  // Another thread may have added the edge since it was looked up, so it is
+  // looked up again once the guard is held.
+  void
+  insert(const CallKey& key) {
+    typename Atomicity::Guard guard{atomicity};
+    uint64_t probes = 0;
+    auto** slot     = find(*index, key, probes);
+    if (*slot) {
+      Atomicity::increment((*slot)->count);
+      return;
     }
-    if (this->callee < other.callee) {
-      return true;
+    cells.push_back({key.site_hash, uint32_t(key.callee), 1});
+    if (sites.find(key.site_hash) == sites.end()) {
+      sites[key.site_hash] = {uint32_t(key.caller),
+                              uint32_t(key.line),
+                              intern_file(key.fname)};
     }
-    if (this->callee > other.callee) {
-      return false;
+    Atomicity::store(*slot, &cells.back());
+    stats.add(&RuntimeStats::counter_inserts);
+    if (++used * 2 > index->size()) {
+      grow();
     }
-    if (this->line < other.line) {
-      return true;
+  }
+
+  // Older indexes are kept until exit, since other threads may still be
+  // probing them.
+  void
+  grow() {
+    indexes.emplace_back(new Index(index->size() * 2));
+    auto* bigger = indexes.back().get();
+    for (auto& cell : cells) {
+      uint64_t probes = 0;
+      CallKey key{0, cell.callee, 0, nullptr, cell.site_hash};
+      *find(*bigger, key, probes) = &cell;
     }
-    if (this->line > other.line) {
-      return false;
+    Atomicity::store(index, bigger);
+    stats.add(&RuntimeStats::counter_growths);
+  }
+
+  // Returns the index of a runtime owned copy of the file name.
+  uint32_t
+  intern_file(const char* fname) {
+    auto inserted = file_ids.emplace(fname, files.size());
+    if (inserted.second) {
+      files.push_back(fname);
     }
-    if (this->fname < other.fname) {
-      return true;
+    return inserted.first->second;
+  }
+
+  Stats& stats;
+  Atomicity atomicity;
+  uint64_t used;
+  Index* index;
+  std::vector<std::unique_ptr<Index>> indexes;
+  std::deque<Cell> cells;
+  std::unordered_map<uint64_t, Site> sites;
+  std::vector<std::string> files;
+  std::unordered_map<std::string, uint32_t> file_ids;
+};
+
+
+// In crash resilient mode, counts live in tables inside the file named by
+// CGPROF_MMAP, so the kernel keeps them even if the program dies. See
+// MappedProfile.h for the layout. The tables never move, and an entry is
+// claimed by writing its callee last, so they are read without a guard.
+template <typename Counter, typename Atomicity, typename Stats>
+class MappedTable {
+public:
+  using Entry = cgprofiler::mapped::Entry<typename Counter::Value>;
+
+  MappedTable(uint64_t sample_period, Stats& stats)
+    : stats{stats}, num_functions{0} {
+    using namespace cgprofiler::mapped;
+    const char* path = getenv("CGPROF_MMAP");
+    if (!path) {
+      path = "callgraph-profile.mapped";
     }
-    return false;
+
+    // A site has at least one edge, so both tables share a capacity.
+    auto capacity          = requested_capacity();
+    uint64_t functions_cap = 1 << 20;
+    auto sites_offset      = ENTRIES_OFFSET + capacity * sizeof(Entry);
+    auto functions_offset  = sites_offset + capacity * sizeof(Site);
+    auto strings_offset    = functions_offset + functions_cap * sizeof(uint32_t);
+    uint64_t strings_cap   = 64 << 20;
+    size = strings_offset + strings_cap;
+
+    // The file is sparse, so only the pages that are touched take up space.
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+      fprintf(stderr, "callgraph-profiler: unable to create %s\n", path);
+      exit(-1);
+    }
+    void* base =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+      fprintf(stderr, "callgraph-profiler: unable to map %s\n", path);
+      exit(-1);
+    }
+
+    auto* bytes = static_cast<char*>(base);
+    header      = static_cast<Header*>(base);
+    entries     = reinterpret_cast<Entry*>(bytes + ENTRIES_OFFSET);
+    sites       = reinterpret_cast<Site*>(bytes + sites_offset);
+    functions   = reinterpret_cast<uint32_t*>(bytes + functions_offset);
+    strings     = bytes + strings_offset;
+
+    header->version           = VERSION;
+    header->state             = RUNNING;
+    header->entrySize         = sizeof(Entry);
+    header->counterBytes      = sizeof(typename Counter::Value);
+    header->samplePeriod      = sample_period;
+    header->capacity          = capacity;
+    header->entriesOffset     = ENTRIES_OFFSET;
+    header->sitesCapacity     = capacity;
+    header->sitesOffset       = sites_offset;
+    header->functionsCapacity = functions_cap;
+    header->functionsOffset   = functions_offset;
+    header->stringsOffset     = strings_offset;
+    header->stringsCapacity   = strings_cap;
+    header->stringsUsed       = 0;
+    header->dropped           = 0;
+    // A file is only recognized once its header is complete.
+    std::atomic_signal_fence(std::memory_order_release);
+    memcpy(header->magic, MAGIC, sizeof(MAGIC));
   }
-  bool
-  operator<(const struct CallInfo& other) const {
-    if (this->caller < other.caller) {
-      return true;
+
+  // Functions are added in order of their global ID. One whose name does not
+  // fit keeps a zero entry, and edges to or from it are not reported.
+  void
+  add_function(const char* name) {
+    typename Atomicity::Guard guard{atomicity};
+    auto id = num_functions++;
+    if (id < header->functionsCapacity) {
+      Atomicity::store(functions[id], add_string(name));
     }
-    if (this->caller > other.caller) {
-      return false;
+  }
+
+  void
+  record(const CallKey& key) {
+    uint64_t probes = 0;
+    auto* entry     = find(key, probes);
+    if (!entry) {
+      Atomicity::add(header->dropped, 1);
+      return;
     }
-    if (this->callee < other.callee) {
-      return true;
+    stats.probe(
+        probes, &RuntimeStats::table_probes, &RuntimeStats::table_max_probe);
+    if (Atomicity::load(entry->callee)) {
+      Atomicity::increment(entry->count);
+      return;
     }
-    if (this->callee > other.callee) {
-      return false;
+    insert(key);
+  }
+
+  // Counts already live in the file, so the exit-time dump only flushes it.
+  void
+  close(const std::vector<std::string>&, uint64_t) {
+    Atomicity::store(header->state, uint32_t(cgprofiler::mapped::COMPLETE));
+    msync(header, size, MS_SYNC);
+  }
+
+private:
+  using Header = cgprofiler::mapped::Header;
+  using Site   = cgprofiler::mapped::Site;
+
+  static uint64_t
+  requested_capacity() {
+    uint64_t requested = 1 << 20;
+    if (auto* requested_entries = getenv("CGPROF_MMAP_ENTRIES")) {
+      requested = strtoull(requested_entries, nullptr, 10);
     }
-    if (this->line < other.line) {
-      return true;
+    uint64_t capacity = 1;
+    while (capacity < requested) {
+      capacity <<= 1;
     }
-    if (this->line > other.line) {
-      return false;
+    return capacity;
+  }
+
+  // Returns the entry for the edge, the empty entry where it belongs, or null
+  // if the table is full. Entries name functions by global ID plus one.
+  Entry*
+  find(const CallKey& key, uint64_t& probes) {
+    uint32_t callee = key.callee + 1;
+    auto hash       = hash_parts({key.site_hash, callee});
+    auto mask       = header->capacity - 1;
+    for (probes = 1; probes <= mask + 1; probes++) {
+      auto& entry  = entries[(hash + probes - 1) & mask];
+      auto claimed = Atomicity::load(entry.callee);
+      if (!claimed || (claimed == callee && entry.siteHash == key.site_hash)) {
+        return &entry;
+      }
+    }
+    return nullptr;
+  }
+
+  // Another thread may have claimed the entry since it was looked up, so it
+  // is looked up again once the guard is held.
+  void
+  insert(const CallKey& key) {
+    typename Atomicity::Guard guard{atomicity};
+    uint64_t probes = 0;
+    auto* entry     = find(key, probes);
+    if (entry && entry->callee) {
+      Atomicity::increment(entry->count);
+      return;
+    }
+    if (!entry || !add_site(key)) {
+      Atomicity::add(header->dropped, 1);
+      return;
     }
-    if (this->fname < other.fname) {
+    stats.add(&RuntimeStats::counter_inserts);
+    entry->siteHash = key.site_hash;
+    entry->count    = 1;
+    Atomicity::store(entry->callee, uint32_t(key.callee + 1));
+  }
+
+  // Returns whether the site of key is in the site table, adding it first if
+  // it is new. Site hashes are already well mixed, so they index it directly.
+  bool
+  add_site(const CallKey& key) {
+    auto mask = header->sitesCapacity - 1;
+    for (uint64_t probe = 0; probe <= mask; probe++) {
+      auto& site = sites[(key.site_hash + probe) & mask];
+      if (site.caller) {
+        if (site.siteHash == key.site_hash) {
+          return true;
+        }
+        continue;
+      }
+      auto file_name = intern_file(key.fname);
+      if (!file_name) {
+        return false;
+      }
+      site.siteHash = key.site_hash;
+      site.filename = file_name;
+      site.line     = key.line;
+      Atomicity::store(site.caller, uint32_t(key.caller + 1));
       return true;
     }
     return false;
   }
+
+  // Returns the string offset of the file name, storing each distinct name
+  // only once.
+  uint32_t
+  intern_file(const char* fname) {
+    auto found = file_names.find(fname);
+    if (found != file_names.end()) {
+      return found->second;
+    }
+    auto offset = add_string(fname);
+    if (offset) {
+      file_names.emplace(fname, offset);
+    }
+    return offset;
+  }
+
+  // Appends str to the string region and returns its offset plus one, or 0
+  // if the region is full.
+  uint32_t
+  add_string(const char* str) {
+    auto length = strlen(str) + 1;
+    if (header->stringsUsed + length > header->stringsCapacity) {
+      return 0;
+    }
+    auto offset = header->stringsUsed;
+    memcpy(strings + offset, str, length);
+    Atomicity::store(header->stringsUsed, header->stringsUsed + length);
+    return offset + 1;
+  }
+
+  Stats& stats;
+  Atomicity atomicity;
+  Header* header;
+  Entry* entries;
+  Site* sites;
+  uint32_t* functions;
+  char* strings;
+  size_t size;
+  uint64_t num_functions;
+  std::unordered_map<std::string, uint32_t> file_names;
 };
 
-typedef std::map<CallInfo, uint64_t> CounterType;
 
-CounterType* call_counter_ptr;
+////////////////////////////////////////////////////////////////////////////
+// The runtime itself
+
+template <typename Counter,
+          typename Atomicity,
+          typename Sampling,
+          typename Stats,
+          template <typename, typename, typename> class Storage>
+class Runtime {
+public:
+  Runtime() : storage{Sampling::PERIOD, stats} {}
+
+  // Functions are identified by address so that a function declared in one
+  // module and defined in another receives a single ID.
+  void
+  register_module(ModuleRecord* record) {
+    typename Atomicity::Guard guard{atomicity};
+    for (uint64_t i = 0; i < record->num_fn; i++) {
+      auto addr = record->id_addr_map[i];
+      if (addr != 0) {
+        auto found = addr_to_id.find(addr);
+        if (found != addr_to_id.end()) {
+          record->global_ids[i] = found->second;
+          continue;
+        }
+        auto buckets     = addr_to_id.bucket_count();
+        addr_to_id[addr] = fn_names.size();
+        if (addr_to_id.bucket_count() != buckets) {
+          stats.add(&RuntimeStats::addr_table_rehashes);
+        }
+      } else {
+        // Functions without an address, such as unresolved weak declarations
+        // and functions that were inlined at every call, are identified by
+        // name instead.
+        auto inserted =
+            name_to_id.emplace(record->fn_names[i], fn_names.size());
+        if (!inserted.second) {
+          record->global_ids[i] = inserted.first->second;
+          continue;
+        }
+      }
+      record->global_ids[i] = fn_names.size();
+      fn_names.push_back(record->fn_names[i]);
+      storage.add_function(record->fn_names[i]);
+    }
+  }
+
+  void
+  count(uint64_t caller,
+        uint64_t callee,
+        uint64_t line,
+        char* fname,
+        uint64_t site_hash) {
+    stats.entered(&EntryCounts::count);
+    if (!Sampling::sample()) {
+      return;
+    }
+    typename Stats::Timer timer{stats};
+    stats.add(&RuntimeStats::recorded_count_calls);
+    storage.record({caller, callee, line, fname, site_hash});
+  }
+
+  void
+  handle_fp(uint64_t caller,
+            uint64_t callee_addr,
+            uint64_t line,
+            char* fname,
+            uint64_t site_hash) {
+    stats.entered(&EntryCounts::handle_fp);
+    if (!Sampling::sample()) {
+      return;
+    }
+    typename Stats::Timer timer{stats};
+    stats.add(&RuntimeStats::recorded_handle_fp_calls);
+    uint64_t callee = 0;
+    {
+      typename Atomicity::SharedGuard guard{atomicity};
+      if (Stats::ENABLED) {
+        stats.probe(count_fp_probes(callee_addr),
+                    &RuntimeStats::fp_probes,
+                    &RuntimeStats::fp_max_probe);
+      }
+      auto found = addr_to_id.find(callee_addr);
+      if (found == addr_to_id.end()) {
+        stats.add(&RuntimeStats::unknown_fp_calls);
+        printf("unknown fp call\n");
+        return;
+      }
+      callee = found->second;
+    }
+    storage.record({caller, callee, line, fname, site_hash});
+  }
+
+  void
+  enter(SiteDescriptor* site, ModuleRecord* record, uint64_t callee) {
+    stats.entered(&EntryCounts::enter);
+    if (!Sampling::sample()) {
+      return;
+    }
+    typename Stats::Timer timer{stats};
+    stats.add(&RuntimeStats::recorded_enter_calls);
+    storage.record({site->module->global_ids[site->caller],
+                    record->global_ids[callee],
+                    site->line,
+                    site->fname,
+                    site->site_hash});
+  }
+
+  void
+  print() {
+    typename Atomicity::Guard guard{atomicity};
+    stats.write(fn_names.size(), Sampling::PERIOD);
+    storage.close(fn_names, Sampling::PERIOD);
+  }
+
+  void
+  debug_print() {
+    printf("=====================\n"
+           "id_addr_map\n"
+           "=====================\n");
+    for (auto& entry : addr_to_id) {
+      printf("%lu: %lu\n", entry.second, entry.first);
+    }
+  }
+
+private:
+  // Returns the number of entries examined to find addr in addr_to_id.
+  uint64_t
+  count_fp_probes(uint64_t addr) {
+    auto bucket     = addr_to_id.bucket(addr);
+    uint64_t probes = 0;
+    for (auto it = addr_to_id.begin(bucket); it != addr_to_id.end(bucket);
+         ++it) {
+      probes++;
+      if (it->first == addr) {
+        break;
+      }
+    }
+    return probes;
+  }
+
+  Atomicity atomicity;
+  Stats stats;
+  Storage<Counter, Atomicity, Stats> storage;
+  // Program wide function table, indexed by global function ID.
+  std::vector<std::string> fn_names;
+  std::unordered_map<uint64_t, uint64_t> addr_to_id;
+  std::unordered_map<std::string, uint64_t> name_to_id;
+};
+
+
+#if CGPROF_COUNTER_BITS == 32
+using CounterPolicy = Counter32;
+#else
+using CounterPolicy = Counter64;
+#endif
+
+#if CGPROF_ATOMIC
+using AtomicityPolicy = Synchronized;
+#else
+using AtomicityPolicy = Unsynchronized;
+#endif
+
+#if CGPROF_SAMPLE_PERIOD > 1
+using SamplingPolicy = RandomSampling<CGPROF_SAMPLE_PERIOD>;
+#else
+using SamplingPolicy = EveryCall;
+#endif
+
+#if CGPROF_COLLECT_STATS
+using StatsPolicy = CollectStats<AtomicityPolicy>;
+#else
+using StatsPolicy = NoStats;
+#endif
+
+#if CGPROF_MAPPED
+template <typename Counter, typename Atomicity, typename Stats>
+using StoragePolicy = MappedTable<Counter, Atomicity, Stats>;
+#else
+template <typename Counter, typename Atomicity, typename Stats>
+using StoragePolicy = HeapTable<Counter, Atomicity, Stats>;
+#endif
+
+using RuntimeType = Runtime<CounterPolicy,
+                            AtomicityPolicy,
+                            SamplingPolicy,
+                            StatsPolicy,
+                            StoragePolicy>;
+
+RuntimeType* runtime_ptr;
+
+
+}  // namespace
+
+
+extern "C" {
+
+
+void CGPROF(print)();
 
 void
 CGPROF(init)() {
-  call_counter_ptr = new CounterType();
+  if (runtime_ptr) {
+    return;
+  }
+  runtime_ptr = new RuntimeType();
+  atexit(CGPROF(print));
 }
 
 void
-CGPROF(count)(uint64_t caller, uint64_t callee, uint64_t line, char* fname) {
-  CounterType& call_counter = *call_counter_ptr;
-  CallInfo key;
-  key.caller = caller;
-  key.callee = callee;
-  key.line   = line;
-  key.fname  = std::string(fname);
-
-  if (call_counter.find(key) == call_counter.end()) {
-    call_counter[key] = 1;
-  } else {
-    call_counter[key]++;
-  }
+CGPROF(register_module)(ModuleRecord* record) {
+  // Module constructors may run before anything else in the runtime, so the
+  // first registration also initializes it.
+  CGPROF(init)();
+  runtime_ptr->register_module(record);
+}
+
+void
+CGPROF(count)(uint64_t caller,
+              uint64_t callee,
+              uint64_t line,
+              char* fname,
+              uint64_t site_hash) {
+  runtime_ptr->count(caller, callee, line, fname, site_hash);
 }
 
 void
 CGPROF(handle_fp)(uint64_t caller,
                   uint64_t callee_addr,
                   uint64_t line,
-                  char* fname) {
+                  char* fname,
+                  uint64_t site_hash) {
   // printf("fp call at %lu\n", callee_addr);
-  uint64_t callee;
-  for (uint64_t i = 0; i < CGPROF(num_fn); i++) {
-    if (CGPROF(id_addr_map)[i] == callee_addr) {
-      callee = i;
-      CGPROF(count)(caller, callee, line, fname);
-      return;
-    }
+  runtime_ptr->handle_fp(caller, callee_addr, line, fname, site_hash);
+}
+
+
+void
+CGPROF(enter)(ModuleRecord* record, uint64_t callee) {
+  // Entries from uninstrumented code, such as main() being called by libc,
+  // find no published site and are not counted. Neither are callbacks made
+  // by an uninstrumented target of the published site, which leave the site
+  // for the caller to count through handle_fp once the call returns.
+  auto* site = CGPROF(site);
+  if (!site || CGPROF(site_target) != record->id_addr_map[callee]) {
+    return;
   }
-  printf("unknown fp call\n");
+  CGPROF(site) = nullptr;
+  runtime_ptr->enter(site, record, callee);
 }
 
 
 void
 CGPROF(debug_print)() {
-  printf("=====================\n"
-         "id_addr_map\n"
-         "=====================\n");
-  for (uint64_t i = 0; i < CGPROF(num_fn); i++) {
-    printf("%lu: %lu\n", i, CGPROF(id_addr_map)[i]);
-  }
+  runtime_ptr->debug_print();
 }
 
 void
 CGPROF(print)() {
-  CounterType& call_counter = *call_counter_ptr;
-  // CGPROF(debug_print)();
-
-  // printf("map size: %lu\n", call_counter.size());
-  printf("=====================\n"
-         "Function Calls\n"
-         "=====================\n");
-  for (auto it = call_counter.begin(); it != call_counter.end(); it++) {
-    auto call_info   = it->first;
-    auto freq        = it->second;
-    auto caller_name = CGPROF(fn_names)[call_info.caller];
-    auto callee_name = CGPROF(fn_names)[call_info.callee];
-    printf("%s %s %lu %s %lu\n",
-           caller_name,
-           call_info.fname.c_str(),
-           call_info.line,
-           callee_name,
-           freq);
-  }
+  runtime_ptr->print();
 }
 }
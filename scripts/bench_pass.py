@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+
+# Times each phase of callgraph-profiler on synthetic modules of growing size
+# so that superlinear behavior in the pass or the driver shows up as a
+# growing per-function cost.
+
+import os
+import subprocess
+import sys
+import tempfile
+
+import gen_module
+
+
+PHASES = ['parse', 'instrument', 'verify', 'codegen', 'save', 'peak-rss-kb']
+
+
+def run_profiler(profiler, module, flags):
+    output = module + '.o'
+    result = subprocess.run(
+        [profiler, module, '-c', '-o', output, '-time-phases'] + flags,
+        stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, check=True)
+    report = {}
+    for line in result.stderr.decode().splitlines():
+        name, _, value = line.partition(',')
+        if name in PHASES:
+            report[name] = value
+    return report
+
+
+def bench(profiler, sizes, args, flags, out):
+    out.write(','.join(['functions', 'call-sites'] + PHASES) + '\n')
+    with tempfile.TemporaryDirectory() as workdir:
+        for size in sizes:
+            module = os.path.join(workdir, 'synthetic{0}.ll'.format(size))
+            with open(module, 'w') as ll:
+                gen_module.write_module(ll, size, args.calls,
+                                        args.indirect_ratio, args.debug_vars,
+                                        args.files, args.seed)
+            report = run_profiler(profiler, module, flags)
+            row = [str(size), str(size * args.calls)]
+            row.extend(report.get(phase, '') for phase in PHASES)
+            out.write(','.join(row) + '\n')
+            out.flush()
+
+
+if __name__ == '__main__':
+    import argparse
+    parser = argparse.ArgumentParser(
+        description='Benchmark callgraph-profiler on synthetic modules.')
+    parser.add_argument('--profiler', default='callgraph-profiler',
+                        help='path to the callgraph-profiler binary')
+    parser.add_argument('--sizes', default='1000,10000,100000',
+                        help='comma separated function counts to measure')
+    parser.add_argument('--calls', type=int, default=10)
+    parser.add_argument('--indirect-ratio', type=float, default=0.1)
+    parser.add_argument('--debug-vars', type=int, default=0)
+    parser.add_argument('--files', type=int, default=1)
+    parser.add_argument('--seed', type=int, default=0)
+    parser.add_argument('--callee-counting', action='store_true',
+                        help='benchmark the callee counting mode')
+    args = parser.parse_args()
+
+    sizes = [int(size) for size in args.sizes.split(',')]
+    flags = ['-callee-counting'] if args.callee_counting else []
+    bench(args.profiler, sizes, args, flags, sys.stdout)
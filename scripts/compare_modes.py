@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+
+import os
+import subprocess
+import tempfile
+import time
+
+
+MODES = [
+    ('call-site', []),
+    ('callee', ['-callee-counting']),
+]
+
+
+def text_size(path):
+    out = subprocess.check_output(['size', path]).decode()
+    return int(out.splitlines()[1].split()[0])
+
+
+def best_runtime(binary, args, runs):
+    best = float('inf')
+    for _ in range(runs):
+        start = time.perf_counter()
+        subprocess.run([binary] + args, stdout=subprocess.DEVNULL,
+                       stderr=subprocess.DEVNULL)
+        best = min(best, time.perf_counter() - start)
+    return best
+
+
+def measure(profiler, module, flags, args, runs, workdir):
+    binary = os.path.join(workdir, 'prog')
+    subprocess.check_call([profiler, module, '-o', binary] + flags,
+                          stdout=subprocess.DEVNULL)
+    return text_size(binary), best_runtime(binary, args, runs)
+
+
+def compare(profiler, modules, args, runs):
+    print('{0:40} {1:>10} {2:>12} {3:>10} {4:>12}'.format(
+        'module', 'site .text', 'site time', 'callee .text', 'callee time'))
+    for module in modules:
+        results = []
+        with tempfile.TemporaryDirectory() as workdir:
+            for _, flags in MODES:
+                results.extend(measure(profiler, module, flags, args, runs,
+                                       workdir))
+        print('{0:40} {1:>10} {2:>12.4f} {3:>10} {4:>12.4f}'.format(
+            os.path.basename(module), *results))
+
+
+if __name__ == '__main__':
+    import argparse
+    parser = argparse.ArgumentParser(
+        description='Compare code size and run time of the call site and '
+                    'callee counting instrumentation modes.')
+    parser.add_argument('modules', nargs='+',
+                        help='bitcode or LLVM assembly files to instrument')
+    parser.add_argument('--profiler', default='callgraph-profiler',
+                        help='path to the callgraph-profiler binary')
+    parser.add_argument('--runs', type=int, default=5,
+                        help='runs per binary; the fastest one is reported')
+    parser.add_argument('--args', default='',
+                        help='arguments passed to each instrumented program')
+    args = parser.parse_args()
+    compare(args.profiler, args.modules, args.args.split(), args.runs)
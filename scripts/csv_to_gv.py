@@ -10,7 +10,8 @@ def get_row_tuples(instream):
 def read_callgraph(instream):
     nodes = set()
     edges = defaultdict(lambda : defaultdict(list))
-    for (caller, filename, line, callee, count) in get_row_tuples(instream):
+    # Newer profiles append a site hash, which the graph does not need.
+    for (caller, filename, line, callee, count, *_) in get_row_tuples(instream):
         nodes.add(caller)
         nodes.add(callee)
         edges[caller][(filename,line)].append((callee, count))
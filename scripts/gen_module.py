@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+
+# Generates synthetic LLVM assembly modules for measuring how the
+# instrumentation pass and the driver scale. The modules are meant to be
+# instrumented and compiled, not run.
+
+import random
+
+
+class Metadata:
+    def __init__(self):
+        self.nodes = []
+
+    def add(self, text):
+        self.nodes.append(text)
+        return '!{0}'.format(len(self.nodes) - 1)
+
+
+def write_module(out, functions, calls, indirect_ratio, debug_vars, files,
+                 seed):
+    rng = random.Random(seed)
+    md = Metadata()
+    cu_file = md.add('!DIFile(filename: "synthetic.c", directory: "/tmp")')
+    empty = md.add('!{}')
+    cu = md.add('distinct !DICompileUnit(language: DW_LANG_C99, '
+                'file: {0}, producer: "gen_module.py", isOptimized: false, '
+                'runtimeVersion: 0, emissionKind: FullDebug, '
+                'enums: {1})'.format(cu_file, empty))
+    dwarf = md.add('!{i32 2, !"Dwarf Version", i32 4}')
+    version = md.add('!{i32 2, !"Debug Info Version", i32 3}')
+    int_ty = md.add('!DIBasicType(name: "int", size: 32, align: 32, '
+                    'encoding: DW_ATE_signed)')
+    fn_ty = md.add('!DISubroutineType(types: {0})'.format(
+        md.add('!{{null, {0}}}'.format(int_ty))))
+    expr = md.add('!DIExpression()')
+    file_nodes = [md.add('!DIFile(filename: "synthetic{0}.c", '
+                         'directory: "/tmp")'.format(i))
+                  for i in range(files)]
+
+    out.write('target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"\n'
+              'target triple = "x86_64-unknown-linux-gnu"\n\n')
+    table_ty = '[{0} x void (i32)*]'.format(functions)
+    out.write('@fn_table = global {0} [{1}]\n\n'.format(
+        table_ty,
+        ', '.join('void (i32)* @f{0}'.format(i) for i in range(functions))))
+
+    for fn in range(functions):
+        file_node = file_nodes[fn % files]
+        line = fn * (calls + debug_vars + 2) + 1
+        sp = md.add('distinct !DISubprogram(name: "f{0}", scope: {1}, '
+                    'file: {1}, line: {2}, type: {3}, isLocal: false, '
+                    'isDefinition: true, scopeLine: {2}, '
+                    'flags: DIFlagPrototyped, isOptimized: false, unit: {4}, '
+                    'variables: {5})'.format(fn, file_node, line, fn_ty, cu,
+                                             empty))
+        out.write('define void @f{0}(i32) !dbg {1} {{\n'.format(fn, sp))
+
+        for var in range(debug_vars):
+            line += 1
+            local = md.add('!DILocalVariable(name: "v{0}", scope: {1}, '
+                           'file: {2}, line: {3}, type: {4})'.format(
+                               var, sp, file_node, line, int_ty))
+            loc = md.add('!DILocation(line: {0}, column: 3, '
+                         'scope: {1})'.format(line, sp))
+            out.write('  call void @llvm.dbg.value(metadata i32 %0, i64 0, '
+                      'metadata {0}, metadata {1}), !dbg {2}\n'.format(
+                          local, expr, loc))
+
+        for site in range(calls):
+            line += 1
+            loc = md.add('!DILocation(line: {0}, column: 3, '
+                         'scope: {1})'.format(line, sp))
+            target = rng.randrange(functions)
+            if rng.random() < indirect_ratio:
+                out.write('  %p{0} = load void (i32)*, void (i32)** '
+                          'getelementptr inbounds ({1}, {1}* @fn_table, '
+                          'i64 0, i64 {2}), !dbg {3}\n'.format(
+                              site, table_ty, target, loc))
+                out.write('  call void %p{0}(i32 %0), !dbg {1}\n'.format(
+                    site, loc))
+            else:
+                out.write('  call void @f{0}(i32 %0), !dbg {1}\n'.format(
+                    target, loc))
+
+        loc = md.add('!DILocation(line: {0}, column: 1, '
+                     'scope: {1})'.format(line + 1, sp))
+        out.write('  ret void, !dbg {0}\n}}\n\n'.format(loc))
+
+    out.write('define i32 @main() {\n  ret i32 0\n}\n\n')
+    out.write('declare void @llvm.dbg.value(metadata, i64, metadata, '
+              'metadata)\n\n')
+    out.write('!llvm.dbg.cu = !{{{0}}}\n'.format(cu))
+    out.write('!llvm.module.flags = !{{{0}, {1}}}\n\n'.format(dwarf, version))
+    for id, node in enumerate(md.nodes):
+        out.write('!{0} = {1}\n'.format(id, node))
+
+
+if __name__ == '__main__':
+    import argparse
+    import sys
+    parser = argparse.ArgumentParser(
+        description='Generate a synthetic LLVM assembly module.')
+    parser.add_argument('-o', dest='output', default=None,
+                        help='output file (default: stdout)')
+    parser.add_argument('--functions', type=int, default=1000,
+                        help='number of defined functions')
+    parser.add_argument('--calls', type=int, default=10,
+                        help='call sites per function')
+    parser.add_argument('--indirect-ratio', type=float, default=0.1,
+                        help='fraction of call sites that are indirect')
+    parser.add_argument('--debug-vars', type=int, default=0,
+                        help='debug variables per function, which scales '
+                             'the size of the debug info')
+    parser.add_argument('--files', type=int, default=1,
+                        help='number of source files the functions span')
+    parser.add_argument('--seed', type=int, default=0)
+    args = parser.parse_args()
+
+    with (open(args.output, 'w') if args.output else sys.stdout) as out:
+        write_module(out, args.functions, args.calls, args.indirect_ratio,
+                     args.debug_vars, args.files, args.seed)
@@ -0,0 +1,14 @@
+#include <stdio.h>
+
+void apply(void (*f)(int), int i);
+void helper(int i);
+
+static void local(int i) {}
+
+int
+main(int argc, char **argv) {
+  apply(helper, 1);
+  apply(local, 2);
+  helper(3);
+  return 0;
+}
@@ -0,0 +1,16 @@
+#include <stdio.h>
+
+int a(const char *s) { return 0; }
+
+int
+main(int argc, char **argv) {
+  int (*funptr)(const char *);
+  if (argc & 1) {
+    funptr = puts;
+  } else {
+    funptr = a;
+  }
+  funptr("through a pointer");
+  a("directly");
+  return 0;
+}
@@ -0,0 +1,20 @@
+#include <stdio.h>
+
+static void
+shout(int times) {
+  for (int i = 0; i < times; i++) {
+    putchar('!');
+  }
+}
+
+int
+main(int argc, char **argv) {
+  for (int i = 0; i < argc + 2; i++) {
+    shout(i);
+  }
+  for (int i = 0; i < 4; i++) {
+    shout(1);
+  }
+  putchar('\n');
+  return 0;
+}
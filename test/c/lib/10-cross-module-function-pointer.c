@@ -0,0 +1,7 @@
+void helper(int i) {}
+
+void
+apply(void (*f)(int), int i) {
+  helper(i);
+  f(i);
+}
@@ -0,0 +1,67 @@
+; ModuleID = '<stdin>'
+source_filename = "c/10-cross-module-function-pointer.c"
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; Function Attrs: nounwind uwtable
+define i32 @main(i32, i8**) #0 !dbg !6 {
+  call void @llvm.dbg.value(metadata i32 %0, i64 0, metadata !13, metadata !14), !dbg !15
+  call void @llvm.dbg.value(metadata i8** %1, i64 0, metadata !16, metadata !14), !dbg !17
+  call void @apply(void (i32)* @helper, i32 1), !dbg !18
+  call void @apply(void (i32)* @local, i32 2), !dbg !19
+  call void @helper(i32 3), !dbg !20
+  ret i32 0, !dbg !21
+}
+
+; Function Attrs: nounwind readnone
+declare void @llvm.dbg.declare(metadata, metadata, metadata) #1
+
+declare void @apply(void (i32)*, i32) #2
+
+declare void @helper(i32) #2
+
+; Function Attrs: nounwind uwtable
+define internal void @local(i32) #0 !dbg !22 {
+  call void @llvm.dbg.value(metadata i32 %0, i64 0, metadata !25, metadata !14), !dbg !26
+  ret void, !dbg !27
+}
+
+; Function Attrs: nounwind readnone
+declare void @llvm.dbg.value(metadata, i64, metadata, metadata) #1
+
+attributes #0 = { nounwind uwtable "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="true" "no-frame-pointer-elim-non-leaf" "no-infs-fp-math"="false" "no-jump-tables"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="x86-64" "target-features"="+fxsr,+mmx,+sse,+sse2,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+attributes #1 = { nounwind readnone }
+attributes #2 = { "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="true" "no-frame-pointer-elim-non-leaf" "no-infs-fp-math"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="x86-64" "target-features"="+fxsr,+mmx,+sse,+sse2,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+!llvm.ident = !{!5}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang version 3.9.0 (tags/RELEASE_390/final)", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "c/10-cross-module-function-pointer.c", directory: "/home/nick/teaching/886/call-profiler/test")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !{!"clang version 3.9.0 (tags/RELEASE_390/final)"}
+!6 = distinct !DISubprogram(name: "main", scope: !1, file: !1, line: 9, type: !7, isLocal: false, isDefinition: true, scopeLine: 9, flags: DIFlagPrototyped, isOptimized: false, unit: !0, variables: !2)
+!7 = !DISubroutineType(types: !8)
+!8 = !{!9, !9, !10}
+!9 = !DIBasicType(name: "int", size: 32, align: 32, encoding: DW_ATE_signed)
+!10 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !11, size: 64, align: 64)
+!11 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !12, size: 64, align: 64)
+!12 = !DIBasicType(name: "char", size: 8, align: 8, encoding: DW_ATE_signed_char)
+!13 = !DILocalVariable(name: "argc", arg: 1, scope: !6, file: !1, line: 9, type: !9)
+!14 = !DIExpression()
+!15 = !DILocation(line: 9, column: 10, scope: !6)
+!16 = !DILocalVariable(name: "argv", arg: 2, scope: !6, file: !1, line: 9, type: !10)
+!17 = !DILocation(line: 9, column: 23, scope: !6)
+!18 = !DILocation(line: 10, column: 3, scope: !6)
+!19 = !DILocation(line: 11, column: 3, scope: !6)
+!20 = !DILocation(line: 12, column: 3, scope: !6)
+!21 = !DILocation(line: 13, column: 3, scope: !6)
+!22 = distinct !DISubprogram(name: "local", scope: !1, file: !1, line: 6, type: !23, isLocal: true, isDefinition: true, scopeLine: 6, flags: DIFlagPrototyped, isOptimized: false, unit: !0, variables: !2)
+!23 = !DISubroutineType(types: !24)
+!24 = !{null, !9}
+!25 = !DILocalVariable(name: "i", arg: 1, scope: !22, file: !1, line: 6, type: !9)
+!26 = !DILocation(line: 6, column: 23, scope: !22)
+!27 = !DILocation(line: 6, column: 27, scope: !22)
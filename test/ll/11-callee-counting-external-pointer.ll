@@ -0,0 +1,90 @@
+; ModuleID = '<stdin>'
+source_filename = "c/11-callee-counting-external-pointer.c"
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@.str = private unnamed_addr constant [18 x i8] c"through a pointer\00", align 1
+@.str.1 = private unnamed_addr constant [9 x i8] c"directly\00", align 1
+
+; Function Attrs: nounwind uwtable
+define i32 @a(i8*) #0 !dbg !6 {
+  call void @llvm.dbg.value(metadata i8* %0, i64 0, metadata !14, metadata !15), !dbg !16
+  ret i32 0, !dbg !17
+}
+
+; Function Attrs: nounwind readnone
+declare void @llvm.dbg.declare(metadata, metadata, metadata) #1
+
+; Function Attrs: nounwind uwtable
+define i32 @main(i32, i8**) #0 !dbg !18 {
+  call void @llvm.dbg.value(metadata i32 %0, i64 0, metadata !23, metadata !15), !dbg !24
+  call void @llvm.dbg.value(metadata i8** %1, i64 0, metadata !25, metadata !15), !dbg !26
+  %3 = and i32 %0, 1, !dbg !27
+  %4 = icmp ne i32 %3, 0, !dbg !27
+  br i1 %4, label %5, label %6, !dbg !29
+
+; <label>:5:                                      ; preds = %2
+  call void @llvm.dbg.value(metadata i32 (i8*)* @puts, i64 0, metadata !30, metadata !15), !dbg !31
+  br label %7, !dbg !32
+
+; <label>:6:                                      ; preds = %2
+  call void @llvm.dbg.value(metadata i32 (i8*)* @a, i64 0, metadata !30, metadata !15), !dbg !31
+  br label %7
+
+; <label>:7:                                      ; preds = %6, %5
+  %.0 = phi i32 (i8*)* [ @puts, %5 ], [ @a, %6 ]
+  %8 = call i32 %.0(i8* getelementptr inbounds ([18 x i8], [18 x i8]* @.str, i32 0, i32 0)), !dbg !34
+  %9 = call i32 @a(i8* getelementptr inbounds ([9 x i8], [9 x i8]* @.str.1, i32 0, i32 0)), !dbg !35
+  ret i32 0, !dbg !36
+}
+
+declare i32 @puts(i8*) #2
+
+; Function Attrs: nounwind readnone
+declare void @llvm.dbg.value(metadata, i64, metadata, metadata) #1
+
+attributes #0 = { nounwind uwtable "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="true" "no-frame-pointer-elim-non-leaf" "no-infs-fp-math"="false" "no-jump-tables"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="x86-64" "target-features"="+fxsr,+mmx,+sse,+sse2,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+attributes #1 = { nounwind readnone }
+attributes #2 = { "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="true" "no-frame-pointer-elim-non-leaf" "no-infs-fp-math"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="x86-64" "target-features"="+fxsr,+mmx,+sse,+sse2,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+!llvm.ident = !{!5}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang version 3.9.0 (tags/RELEASE_390/final)", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "c/11-callee-counting-external-pointer.c", directory: "/home/nick/teaching/886/call-profiler/test")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !{!"clang version 3.9.0 (tags/RELEASE_390/final)"}
+!6 = distinct !DISubprogram(name: "a", scope: !1, file: !1, line: 3, type: !7, isLocal: false, isDefinition: true, scopeLine: 3, flags: DIFlagPrototyped, isOptimized: false, unit: !0, variables: !2)
+!7 = !DISubroutineType(types: !8)
+!8 = !{!9, !10}
+!9 = !DIBasicType(name: "int", size: 32, align: 32, encoding: DW_ATE_signed)
+!10 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !11, size: 64, align: 64)
+!11 = !DIDerivedType(tag: DW_TAG_const_type, baseType: !12)
+!12 = !DIBasicType(name: "char", size: 8, align: 8, encoding: DW_ATE_signed_char)
+!13 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !12, size: 64, align: 64)
+!14 = !DILocalVariable(name: "s", arg: 1, scope: !6, file: !1, line: 3, type: !10)
+!15 = !DIExpression()
+!16 = !DILocation(line: 3, column: 19, scope: !6)
+!17 = !DILocation(line: 3, column: 24, scope: !6)
+!18 = distinct !DISubprogram(name: "main", scope: !1, file: !1, line: 6, type: !19, isLocal: false, isDefinition: true, scopeLine: 6, flags: DIFlagPrototyped, isOptimized: false, unit: !0, variables: !2)
+!19 = !DISubroutineType(types: !20)
+!20 = !{!9, !9, !21}
+!21 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !13, size: 64, align: 64)
+!22 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !7, size: 64, align: 64)
+!23 = !DILocalVariable(name: "argc", arg: 1, scope: !18, file: !1, line: 6, type: !9)
+!24 = !DILocation(line: 6, column: 10, scope: !18)
+!25 = !DILocalVariable(name: "argv", arg: 2, scope: !18, file: !1, line: 6, type: !21)
+!26 = !DILocation(line: 6, column: 23, scope: !18)
+!27 = !DILocation(line: 8, column: 12, scope: !28)
+!28 = distinct !DILexicalBlock(scope: !18, file: !1, line: 8, column: 7)
+!29 = !DILocation(line: 8, column: 7, scope: !18)
+!30 = !DILocalVariable(name: "funptr", scope: !18, file: !1, line: 7, type: !22)
+!31 = !DILocation(line: 7, column: 9, scope: !18)
+!32 = !DILocation(line: 10, column: 3, scope: !33)
+!33 = distinct !DILexicalBlock(scope: !28, file: !1, line: 8, column: 17)
+!34 = !DILocation(line: 13, column: 3, scope: !18)
+!35 = !DILocation(line: 14, column: 3, scope: !18)
+!36 = !DILocation(line: 15, column: 3, scope: !18)
@@ -0,0 +1,165 @@
+; ModuleID = '<stdin>'
+source_filename = "c/12-inlined-call-with-loop.c"
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; Function Attrs: nounwind uwtable
+define internal void @shout(i32) #0 !dbg !6 {
+  call void @llvm.dbg.value(metadata i32 %0, i64 0, metadata !10, metadata !11), !dbg !12
+  call void @llvm.dbg.value(metadata i32 0, i64 0, metadata !13, metadata !11), !dbg !15
+  br label %2, !dbg !16
+
+; <label>:2:                                      ; preds = %6, %1
+  %.0 = phi i32 [ 0, %1 ], [ %7, %6 ]
+  %3 = icmp slt i32 %.0, %0, !dbg !17
+  br i1 %3, label %4, label %8, !dbg !20
+
+; <label>:4:                                      ; preds = %2
+  %5 = call i32 @putchar(i32 33), !dbg !21
+  br label %6, !dbg !23
+
+; <label>:6:                                      ; preds = %4
+  %7 = add nsw i32 %.0, 1, !dbg !24
+  call void @llvm.dbg.value(metadata i32 %7, i64 0, metadata !13, metadata !11), !dbg !15
+  br label %2, !dbg !26, !llvm.loop !27
+
+; <label>:8:                                      ; preds = %2
+  ret void, !dbg !29
+}
+
+; Function Attrs: nounwind readnone
+declare void @llvm.dbg.declare(metadata, metadata, metadata) #1
+
+declare i32 @putchar(i32) #2
+
+; Function Attrs: nounwind uwtable
+define i32 @main(i32, i8**) #0 !dbg !30 {
+  call void @llvm.dbg.value(metadata i32 %0, i64 0, metadata !36, metadata !11), !dbg !37
+  call void @llvm.dbg.value(metadata i8** %1, i64 0, metadata !38, metadata !11), !dbg !39
+  call void @llvm.dbg.value(metadata i32 0, i64 0, metadata !40, metadata !11), !dbg !42
+  br label %3, !dbg !43
+
+; <label>:3:                                      ; preds = %7, %2
+  %.01 = phi i32 [ 0, %2 ], [ %8, %7 ]
+  %4 = add nsw i32 %0, 2, !dbg !44
+  %5 = icmp slt i32 %.01, %4, !dbg !47
+  br i1 %5, label %6, label %9, !dbg !48
+
+; <label>:6:                                      ; preds = %3
+  call void @shout(i32 %.01), !dbg !49
+  br label %7, !dbg !51
+
+; <label>:7:                                      ; preds = %6
+  %8 = add nsw i32 %.01, 1, !dbg !52
+  call void @llvm.dbg.value(metadata i32 %8, i64 0, metadata !40, metadata !11), !dbg !42
+  br label %3, !dbg !54, !llvm.loop !55
+
+; <label>:9:                                      ; preds = %3
+  call void @llvm.dbg.value(metadata i32 0, i64 0, metadata !57, metadata !11), !dbg !59
+  br label %10, !dbg !60
+
+; <label>:10:                                     ; preds = %13, %9
+  %.0 = phi i32 [ 0, %9 ], [ %14, %13 ]
+  %11 = icmp slt i32 %.0, 4, !dbg !61
+  br i1 %11, label %12, label %15, !dbg !64
+
+; <label>:12:                                     ; preds = %10
+  call void @shout(i32 1), !dbg !65
+  br label %13, !dbg !67
+
+; <label>:13:                                     ; preds = %12
+  %14 = add nsw i32 %.0, 1, !dbg !68
+  call void @llvm.dbg.value(metadata i32 %14, i64 0, metadata !57, metadata !11), !dbg !59
+  br label %10, !dbg !70, !llvm.loop !71
+
+; <label>:15:                                     ; preds = %10
+  %16 = call i32 @putchar(i32 10), !dbg !73
+  ret i32 0, !dbg !74
+}
+
+; Function Attrs: nounwind readnone
+declare void @llvm.dbg.value(metadata, i64, metadata, metadata) #1
+
+attributes #0 = { nounwind uwtable "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="true" "no-frame-pointer-elim-non-leaf" "no-infs-fp-math"="false" "no-jump-tables"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="x86-64" "target-features"="+fxsr,+mmx,+sse,+sse2,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+attributes #1 = { nounwind readnone }
+attributes #2 = { "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="true" "no-frame-pointer-elim-non-leaf" "no-infs-fp-math"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="x86-64" "target-features"="+fxsr,+mmx,+sse,+sse2,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+!llvm.ident = !{!5}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang version 3.9.0 (tags/RELEASE_390/final)", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "c/12-inlined-call-with-loop.c", directory: "/home/nick/teaching/886/call-profiler/test")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !{!"clang version 3.9.0 (tags/RELEASE_390/final)"}
+!6 = distinct !DISubprogram(name: "shout", scope: !1, file: !1, line: 4, type: !7, isLocal: true, isDefinition: true, scopeLine: 4, flags: DIFlagPrototyped, isOptimized: false, unit: !0, variables: !2)
+!7 = !DISubroutineType(types: !8)
+!8 = !{null, !9}
+!9 = !DIBasicType(name: "int", size: 32, align: 32, encoding: DW_ATE_signed)
+!10 = !DILocalVariable(name: "times", arg: 1, scope: !6, file: !1, line: 4, type: !9)
+!11 = !DIExpression()
+!12 = !DILocation(line: 4, column: 11, scope: !6)
+!13 = !DILocalVariable(name: "i", scope: !14, file: !1, line: 5, type: !9)
+!14 = distinct !DILexicalBlock(scope: !6, file: !1, line: 5, column: 3)
+!15 = !DILocation(line: 5, column: 12, scope: !14)
+!16 = !DILocation(line: 5, column: 8, scope: !14)
+!17 = !DILocation(line: 5, column: 21, scope: !18)
+!18 = !DILexicalBlockFile(scope: !19, file: !1, discriminator: 1)
+!19 = distinct !DILexicalBlock(scope: !14, file: !1, line: 5, column: 3)
+!20 = !DILocation(line: 5, column: 3, scope: !18)
+!21 = !DILocation(line: 6, column: 5, scope: !22)
+!22 = distinct !DILexicalBlock(scope: !19, file: !1, line: 5, column: 35)
+!23 = !DILocation(line: 7, column: 3, scope: !22)
+!24 = !DILocation(line: 5, column: 31, scope: !25)
+!25 = !DILexicalBlockFile(scope: !19, file: !1, discriminator: 2)
+!26 = !DILocation(line: 5, column: 3, scope: !25)
+!27 = distinct !{!27, !28}
+!28 = !DILocation(line: 5, column: 3, scope: !6)
+!29 = !DILocation(line: 8, column: 1, scope: !6)
+!30 = distinct !DISubprogram(name: "main", scope: !1, file: !1, line: 11, type: !31, isLocal: false, isDefinition: true, scopeLine: 11, flags: DIFlagPrototyped, isOptimized: false, unit: !0, variables: !2)
+!31 = !DISubroutineType(types: !32)
+!32 = !{!9, !9, !33}
+!33 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !34, size: 64, align: 64)
+!34 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !35, size: 64, align: 64)
+!35 = !DIBasicType(name: "char", size: 8, align: 8, encoding: DW_ATE_signed_char)
+!36 = !DILocalVariable(name: "argc", arg: 1, scope: !30, file: !1, line: 11, type: !9)
+!37 = !DILocation(line: 11, column: 10, scope: !30)
+!38 = !DILocalVariable(name: "argv", arg: 2, scope: !30, file: !1, line: 11, type: !33)
+!39 = !DILocation(line: 11, column: 23, scope: !30)
+!40 = !DILocalVariable(name: "i", scope: !41, file: !1, line: 12, type: !9)
+!41 = distinct !DILexicalBlock(scope: !30, file: !1, line: 12, column: 3)
+!42 = !DILocation(line: 12, column: 12, scope: !41)
+!43 = !DILocation(line: 12, column: 8, scope: !41)
+!44 = !DILocation(line: 12, column: 28, scope: !45)
+!45 = !DILexicalBlockFile(scope: !46, file: !1, discriminator: 1)
+!46 = distinct !DILexicalBlock(scope: !41, file: !1, line: 12, column: 3)
+!47 = !DILocation(line: 12, column: 21, scope: !45)
+!48 = !DILocation(line: 12, column: 3, scope: !45)
+!49 = !DILocation(line: 13, column: 5, scope: !50)
+!50 = distinct !DILexicalBlock(scope: !46, file: !1, line: 12, column: 38)
+!51 = !DILocation(line: 14, column: 3, scope: !50)
+!52 = !DILocation(line: 12, column: 34, scope: !53)
+!53 = !DILexicalBlockFile(scope: !46, file: !1, discriminator: 2)
+!54 = !DILocation(line: 12, column: 3, scope: !53)
+!55 = distinct !{!55, !56}
+!56 = !DILocation(line: 12, column: 3, scope: !30)
+!57 = !DILocalVariable(name: "i", scope: !58, file: !1, line: 15, type: !9)
+!58 = distinct !DILexicalBlock(scope: !30, file: !1, line: 15, column: 3)
+!59 = !DILocation(line: 15, column: 12, scope: !58)
+!60 = !DILocation(line: 15, column: 8, scope: !58)
+!61 = !DILocation(line: 15, column: 21, scope: !62)
+!62 = !DILexicalBlockFile(scope: !63, file: !1, discriminator: 1)
+!63 = distinct !DILexicalBlock(scope: !58, file: !1, line: 15, column: 3)
+!64 = !DILocation(line: 15, column: 3, scope: !62)
+!65 = !DILocation(line: 16, column: 5, scope: !66)
+!66 = distinct !DILexicalBlock(scope: !63, file: !1, line: 15, column: 31)
+!67 = !DILocation(line: 17, column: 3, scope: !66)
+!68 = !DILocation(line: 15, column: 27, scope: !69)
+!69 = !DILexicalBlockFile(scope: !63, file: !1, discriminator: 2)
+!70 = !DILocation(line: 15, column: 3, scope: !69)
+!71 = distinct !{!71, !72}
+!72 = !DILocation(line: 15, column: 3, scope: !30)
+!73 = !DILocation(line: 18, column: 3, scope: !30)
+!74 = !DILocation(line: 19, column: 3, scope: !30)
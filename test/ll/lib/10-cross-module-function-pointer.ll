@@ -0,0 +1,58 @@
+; ModuleID = '<stdin>'
+source_filename = "c/lib/10-cross-module-function-pointer.c"
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; Function Attrs: nounwind uwtable
+define void @helper(i32) #0 !dbg !6 {
+  call void @llvm.dbg.value(metadata i32 %0, i64 0, metadata !10, metadata !11), !dbg !12
+  ret void, !dbg !13
+}
+
+; Function Attrs: nounwind readnone
+declare void @llvm.dbg.declare(metadata, metadata, metadata) #1
+
+; Function Attrs: nounwind uwtable
+define void @apply(void (i32)*, i32) #0 !dbg !14 {
+  call void @llvm.dbg.value(metadata void (i32)* %0, i64 0, metadata !18, metadata !11), !dbg !19
+  call void @llvm.dbg.value(metadata i32 %1, i64 0, metadata !20, metadata !11), !dbg !21
+  call void @helper(i32 %1), !dbg !22
+  call void %0(i32 %1), !dbg !23
+  ret void, !dbg !24
+}
+
+; Function Attrs: nounwind readnone
+declare void @llvm.dbg.value(metadata, i64, metadata, metadata) #1
+
+attributes #0 = { nounwind uwtable "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="true" "no-frame-pointer-elim-non-leaf" "no-infs-fp-math"="false" "no-jump-tables"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="x86-64" "target-features"="+fxsr,+mmx,+sse,+sse2,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
+attributes #1 = { nounwind readnone }
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+!llvm.ident = !{!5}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang version 3.9.0 (tags/RELEASE_390/final)", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "c/lib/10-cross-module-function-pointer.c", directory: "/home/nick/teaching/886/call-profiler/test")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !{!"clang version 3.9.0 (tags/RELEASE_390/final)"}
+!6 = distinct !DISubprogram(name: "helper", scope: !1, file: !1, line: 1, type: !7, isLocal: false, isDefinition: true, scopeLine: 1, flags: DIFlagPrototyped, isOptimized: false, unit: !0, variables: !2)
+!7 = !DISubroutineType(types: !8)
+!8 = !{null, !9}
+!9 = !DIBasicType(name: "int", size: 32, align: 32, encoding: DW_ATE_signed)
+!10 = !DILocalVariable(name: "i", arg: 1, scope: !6, file: !1, line: 1, type: !9)
+!11 = !DIExpression()
+!12 = !DILocation(line: 1, column: 17, scope: !6)
+!13 = !DILocation(line: 1, column: 21, scope: !6)
+!14 = distinct !DISubprogram(name: "apply", scope: !1, file: !1, line: 4, type: !15, isLocal: false, isDefinition: true, scopeLine: 4, flags: DIFlagPrototyped, isOptimized: false, unit: !0, variables: !2)
+!15 = !DISubroutineType(types: !16)
+!16 = !{null, !17, !9}
+!17 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !7, size: 64, align: 64)
+!18 = !DILocalVariable(name: "f", arg: 1, scope: !14, file: !1, line: 4, type: !17)
+!19 = !DILocation(line: 4, column: 14, scope: !14)
+!20 = !DILocalVariable(name: "i", arg: 2, scope: !14, file: !1, line: 4, type: !9)
+!21 = !DILocation(line: 4, column: 31, scope: !14)
+!22 = !DILocation(line: 5, column: 3, scope: !14)
+!23 = !DILocation(line: 6, column: 3, scope: !14)
+!24 = !DILocation(line: 7, column: 1, scope: !14)
@@ -0,0 +1,528 @@
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "CallGraph.h"
+#include "Profile.h"
+#include "Subcommands.h"
+
+
+using namespace llvm;
+using cgprofiler::CallGraph;
+using cgprofiler::Components;
+using cgprofiler::StringTable;
+using cgprofiler::parallelFor;
+using std::string;
+using std::vector;
+
+
+cl::SubCommand analyzeCommand{"analyze",
+                              "Report whole graph properties of a profile"};
+
+static cl::opt<string> profilePath{cl::Positional,
+                                   cl::desc{"<profile>"},
+                                   cl::Required,
+                                   cl::sub(analyzeCommand)};
+
+enum class ReportFormat { Text, JSON };
+
+static cl::opt<ReportFormat> reportFormat{
+    "format",
+    cl::desc{"Format of the report"},
+    cl::values(clEnumValN(ReportFormat::Text, "text", "Plain text"),
+               clEnumValN(ReportFormat::JSON, "json", "JSON")),
+    cl::init(ReportFormat::Text),
+    cl::sub(analyzeCommand)};
+
+static cl::opt<unsigned> topEntries{
+    "top",
+    cl::desc{"Number of entries in each ranked section of the report"},
+    cl::init(20),
+    cl::sub(analyzeCommand)};
+
+static cl::opt<unsigned> threads{
+    "j",
+    cl::desc{"Number of threads to analyze the graph with"},
+    cl::init(std::max(1u, std::thread::hardware_concurrency())),
+    cl::sub(analyzeCommand)};
+
+
+namespace {
+
+struct NodeMetrics {
+  vector<uint64_t> inCalls;
+  vector<uint64_t> outCalls;
+  uint64_t totalCalls;
+};
+
+struct Recursion {
+  uint32_t component;
+  uint64_t internalCalls;
+};
+
+// A root to leaf path through the graph with recursive components collapsed.
+// Its heat is the smallest call count along it.
+struct HotPath {
+  vector<uint32_t> components;
+  uint64_t heat;
+  uint64_t calls;
+};
+
+// The graph of strongly connected components, with the calls between each
+// pair of components merged.
+struct Condensation {
+  vector<uint64_t> offsets;
+  vector<uint32_t> targets;
+  vector<uint64_t> weights;
+  vector<bool> hasCallers;
+};
+
+}  // namespace
+
+
+static NodeMetrics
+computeMetrics(const CallGraph& graph) {
+  NodeMetrics metrics;
+  metrics.inCalls.resize(graph.size());
+  metrics.outCalls.resize(graph.size());
+  parallelFor(graph.size(), threads, [&graph, &metrics](size_t n) {
+    auto in = graph.inWeights.begin();
+    metrics.inCalls[n] = std::accumulate(
+        in + graph.inOffsets[n], in + graph.inOffsets[n + 1], uint64_t(0));
+    auto out = graph.outWeights.begin();
+    metrics.outCalls[n] = std::accumulate(
+        out + graph.outOffsets[n], out + graph.outOffsets[n + 1], uint64_t(0));
+  });
+  metrics.totalCalls = std::accumulate(
+      metrics.inCalls.begin(), metrics.inCalls.end(), uint64_t(0));
+  return metrics;
+}
+
+
+// Returns the indices of the largest keys, at most -top of them.
+template <typename Key>
+static vector<uint32_t>
+topBy(size_t count, Key key) {
+  vector<uint32_t> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  auto shown = std::min<size_t>(topEntries, count);
+  std::partial_sort(order.begin(),
+                    order.begin() + shown,
+                    order.end(),
+                    [&key](uint32_t a, uint32_t b) { return key(a) > key(b); });
+  order.resize(shown);
+  return order;
+}
+
+
+static vector<Recursion>
+findRecursion(const CallGraph& graph, const Components& components) {
+  vector<uint64_t> internalCalls(components.size());
+  parallelFor(components.size(), threads, [&](size_t c) {
+    uint64_t calls = 0;
+    for (auto m = components.memberOffsets[c];
+         m < components.memberOffsets[c + 1];
+         ++m) {
+      auto node = components.members[m];
+      for (auto e = graph.outOffsets[node]; e < graph.outOffsets[node + 1];
+           ++e) {
+        if (components.component[graph.outTargets[e]] == c) {
+          calls += graph.outWeights[e];
+        }
+      }
+    }
+    internalCalls[c] = calls;
+  });
+
+  vector<Recursion> recursion;
+  for (uint32_t c = 0; c < components.size(); ++c) {
+    if (internalCalls[c] != 0) {
+      recursion.push_back({c, internalCalls[c]});
+    }
+  }
+  std::sort(recursion.begin(),
+            recursion.end(),
+            [](const Recursion& a, const Recursion& b) {
+              return a.internalCalls > b.internalCalls;
+            });
+  if (recursion.size() > topEntries) {
+    recursion.resize(topEntries);
+  }
+  return recursion;
+}
+
+
+static Condensation
+condense(const CallGraph& graph, const Components& components) {
+  struct Edge {
+    uint32_t source;
+    uint32_t target;
+    uint64_t weight;
+  };
+  vector<Edge> edges;
+  for (uint32_t node = 0; node < graph.size(); ++node) {
+    auto source = components.component[node];
+    for (auto e = graph.outOffsets[node]; e < graph.outOffsets[node + 1];
+         ++e) {
+      auto target = components.component[graph.outTargets[e]];
+      if (source != target) {
+        edges.push_back({source, target, graph.outWeights[e]});
+      }
+    }
+  }
+  std::sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) {
+    return std::tie(a.source, a.target) < std::tie(b.source, b.target);
+  });
+
+  Condensation condensed;
+  condensed.offsets.assign(components.size() + 1, 0);
+  condensed.hasCallers.assign(components.size(), false);
+  for (auto& edge : edges) {
+    if (!condensed.targets.empty() && condensed.targets.back() == edge.target
+        && condensed.offsets[edge.source + 1] != 0) {
+      condensed.weights.back() += edge.weight;
+      continue;
+    }
+    condensed.offsets[edge.source + 1]++;
+    condensed.targets.push_back(edge.target);
+    condensed.weights.push_back(edge.weight);
+    condensed.hasCallers[edge.target] = true;
+  }
+  for (size_t c = 0; c < components.size(); ++c) {
+    condensed.offsets[c + 1] += condensed.offsets[c];
+  }
+  return condensed;
+}
+
+
+// Finds the hottest path from every component down to a leaf. Components are
+// grouped by their height above the leaves, and each group is solved in
+// parallel once the groups below it are done.
+static vector<HotPath>
+findHotPaths(const Components& components, const Condensation& condensed) {
+  auto count = components.size();
+  constexpr uint32_t NONE = UINT32_MAX;
+
+  // Components are numbered callees first, so heights take one pass.
+  vector<uint32_t> height(count, 0);
+  uint32_t maxHeight = 0;
+  for (uint32_t c = 0; c < count; ++c) {
+    for (auto e = condensed.offsets[c]; e < condensed.offsets[c + 1]; ++e) {
+      height[c] = std::max(height[c], height[condensed.targets[e]] + 1);
+    }
+    maxHeight = std::max(maxHeight, height[c]);
+  }
+  vector<vector<uint32_t>> levels(maxHeight + 1);
+  for (uint32_t c = 0; c < count; ++c) {
+    levels[height[c]].push_back(c);
+  }
+
+  vector<uint64_t> heat(count, UINT64_MAX);
+  vector<uint32_t> next(count, NONE);
+  for (auto& level : levels) {
+    parallelFor(level.size(), threads, [&](size_t i) {
+      auto c = level[i];
+      for (auto e = condensed.offsets[c]; e < condensed.offsets[c + 1]; ++e) {
+        auto target    = condensed.targets[e];
+        auto candidate = std::min(condensed.weights[e], heat[target]);
+        if (next[c] == NONE || candidate > heat[c]) {
+          heat[c] = candidate;
+          next[c] = target;
+        }
+      }
+    });
+  }
+
+  // Each call out of a root starts a candidate path.
+  vector<std::tuple<uint64_t, uint32_t, uint64_t>> starts;
+  for (uint32_t c = 0; c < count; ++c) {
+    if (condensed.hasCallers[c]) {
+      continue;
+    }
+    for (auto e = condensed.offsets[c]; e < condensed.offsets[c + 1]; ++e) {
+      auto target = condensed.targets[e];
+      starts.emplace_back(std::min(condensed.weights[e], heat[target]), c, e);
+    }
+  }
+  auto shown = std::min<size_t>(topEntries, starts.size());
+  std::partial_sort(starts.begin(),
+                    starts.begin() + shown,
+                    starts.end(),
+                    std::greater<std::tuple<uint64_t, uint32_t, uint64_t>>());
+
+  vector<HotPath> paths;
+  for (auto it = starts.begin(); it != starts.begin() + shown; ++it) {
+    HotPath path;
+    path.heat  = std::get<0>(*it);
+    auto edge  = std::get<2>(*it);
+    path.calls = condensed.weights[edge];
+    path.components.push_back(std::get<1>(*it));
+    for (auto c = condensed.targets[edge]; c != NONE; c = next[c]) {
+      path.components.push_back(c);
+      if (next[c] != NONE) {
+        auto e = std::find(condensed.targets.begin() + condensed.offsets[c],
+                           condensed.targets.begin() + condensed.offsets[c + 1],
+                           next[c]);
+        path.calls += condensed.weights[e - condensed.targets.begin()];
+      }
+    }
+    paths.push_back(std::move(path));
+  }
+  return paths;
+}
+
+
+static void
+printJSONString(raw_ostream& out, StringRef str) {
+  out << '"';
+  for (auto c : str) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out << format("\\u%04x", c);
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+
+namespace {
+
+// Prints the report either as text or as JSON. Sections are lists of
+// records, and each record is a list of named fields.
+class Report {
+public:
+  Report(raw_ostream& out, const StringTable& strings, const CallGraph& graph)
+    : out{out}, strings{strings}, graph{graph} {}
+
+  void
+  beginReport() {
+    if (json()) {
+      out << "{";
+    }
+  }
+
+  void
+  endReport() {
+    if (json()) {
+      out << "\n}\n";
+    }
+  }
+
+  void
+  summary(uint64_t functions, uint64_t edges, uint64_t calls) {
+    if (json()) {
+      out << "\n  \"functions\": " << functions << ",\n  \"edges\": " << edges
+          << ",\n  \"calls\": " << calls;
+    } else {
+      out << "functions " << functions << "\nedges " << edges << "\ncalls "
+          << calls << "\n";
+    }
+  }
+
+  void
+  beginSection(StringRef name) {
+    if (json()) {
+      out << ",\n  \"" << name << "\": [";
+    } else {
+      out << "\n" << name << "\n";
+    }
+    firstRecord = true;
+  }
+
+  void
+  endSection() {
+    if (json()) {
+      out << (firstRecord ? "]" : "\n  ]");
+    }
+  }
+
+  void
+  beginRecord() {
+    if (json()) {
+      out << (firstRecord ? "\n    {" : ",\n    {");
+    } else {
+      out << " ";
+    }
+    firstRecord = false;
+    firstField  = true;
+  }
+
+  void
+  endRecord() {
+    out << (json() ? "}" : "\n");
+  }
+
+  void
+  field(StringRef name, uint64_t value) {
+    beginField(name);
+    out << value;
+  }
+
+  void
+  field(StringRef name, double value) {
+    beginField(name);
+    out << format("%.6f", value);
+  }
+
+  void
+  function(StringRef name, uint32_t node) {
+    beginField(name);
+    printName(node);
+  }
+
+  // Prints the functions of a component, in braces when there are several.
+  // At most -top of them are listed, followed by an ellipsis in text.
+  void
+  component(const Components& components, uint32_t c) {
+    auto begin = components.memberOffsets[c];
+    auto end   = components.memberOffsets[c + 1];
+    auto shown = begin + std::min<uint64_t>(end - begin, topEntries);
+    out << (json() ? "[" : end - begin > 1 ? "{" : "");
+    for (auto m = begin; m < shown; ++m) {
+      out << (m == begin ? "" : ",");
+      printName(components.members[m]);
+    }
+    if (shown < end && !json()) {
+      out << ",...";
+    }
+    out << (json() ? "]" : end - begin > 1 ? "}" : "");
+  }
+
+  void
+  components(StringRef name,
+             const Components& all,
+             const vector<uint32_t>& list) {
+    beginField(name);
+    out << (json() ? "[" : "");
+    for (auto& c : list) {
+      out << (&c == &list.front() ? "" : json() ? ", " : " -> ");
+      component(all, c);
+    }
+    out << (json() ? "]" : "");
+  }
+
+  void
+  beginField(StringRef name) {
+    if (json()) {
+      out << (firstField ? "\"" : ", \"") << name << "\": ";
+    } else {
+      out << " " << name << "=";
+    }
+    firstField = false;
+  }
+
+private:
+  bool
+  json() const {
+    return reportFormat == ReportFormat::JSON;
+  }
+
+  void
+  printName(uint32_t node) {
+    auto name = strings.get(graph.names[node]);
+    if (json()) {
+      printJSONString(out, name);
+    } else {
+      out << name;
+    }
+  }
+
+  raw_ostream& out;
+  const StringTable& strings;
+  const CallGraph& graph;
+  bool firstRecord = true;
+  bool firstField  = true;
+};
+
+}  // namespace
+
+
+int
+runAnalyze() {
+  StringTable strings;
+  auto profile = cgprofiler::readProfile(profilePath, strings);
+  if (!profile) {
+    errs() << "Error reading profile " << profilePath << ": "
+           << profile.getError().message() << "\n";
+    return -1;
+  }
+  warnIfPartial(profilePath, *profile);
+
+  auto graph      = CallGraph::fromProfile(*profile);
+  auto metrics    = computeMetrics(graph);
+  auto components = cgprofiler::findComponents(graph);
+  auto recursion  = findRecursion(graph, components);
+  auto condensed  = condense(graph, components);
+  auto paths      = findHotPaths(components, condensed);
+
+  Report report{outs(), strings, graph};
+  report.beginReport();
+  report.summary(graph.size(), graph.outTargets.size(), metrics.totalCalls);
+
+  report.beginSection("shares");
+  auto total = std::max<uint64_t>(1, metrics.totalCalls);
+  for (auto node : topBy(graph.size(), [&](uint32_t n) {
+         return metrics.inCalls[n];
+       })) {
+    report.beginRecord();
+    report.function("function", node);
+    report.field("calls", metrics.inCalls[node]);
+    report.field("share", double(metrics.inCalls[node]) / total);
+    report.endRecord();
+  }
+  report.endSection();
+
+  auto fanSection = [&](StringRef name,
+                        const vector<uint64_t>& offsets,
+                        const vector<uint64_t>& calls) {
+    report.beginSection(name);
+    for (auto node : topBy(graph.size(), [&](uint32_t n) {
+           return std::make_pair(offsets[n + 1] - offsets[n], calls[n]);
+         })) {
+      report.beginRecord();
+      report.function("function", node);
+      report.field("functions", offsets[node + 1] - offsets[node]);
+      report.field("calls", calls[node]);
+      report.endRecord();
+    }
+    report.endSection();
+  };
+  fanSection("fan-in", graph.inOffsets, metrics.inCalls);
+  fanSection("fan-out", graph.outOffsets, metrics.outCalls);
+
+  report.beginSection("recursion");
+  for (auto& cycle : recursion) {
+    report.beginRecord();
+    report.components("functions", components, {cycle.component});
+    report.field("members",
+                 components.memberOffsets[cycle.component + 1]
+                     - components.memberOffsets[cycle.component]);
+    report.field("calls", cycle.internalCalls);
+    report.endRecord();
+  }
+  report.endSection();
+
+  report.beginSection("hot-paths");
+  for (auto& path : paths) {
+    report.beginRecord();
+    report.field("heat", path.heat);
+    report.field("calls", path.calls);
+    report.components("path", components, path.components);
+    report.endRecord();
+  }
+  report.endSection();
+  report.endReport();
+
+  return 0;
+}
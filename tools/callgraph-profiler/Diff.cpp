@@ -0,0 +1,227 @@
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "Profile.h"
+#include "Subcommands.h"
+
+
+using namespace llvm;
+using cgprofiler::EdgeMatch;
+using cgprofiler::Profile;
+using cgprofiler::ProfileEdge;
+using cgprofiler::StringTable;
+using std::string;
+using std::vector;
+
+
+cl::SubCommand diffCommand{"diff",
+                           "Compare the call graph profiles of two builds"};
+
+static cl::opt<string> oldPath{cl::Positional,
+                               cl::desc{"<old profile>"},
+                               cl::Required,
+                               cl::sub(diffCommand)};
+
+static cl::opt<string> newPath{cl::Positional,
+                               cl::desc{"<new profile>"},
+                               cl::Required,
+                               cl::sub(diffCommand)};
+
+enum class Normalization { None, Total, Root };
+
+static cl::opt<Normalization> normalization{
+    "normalize",
+    cl::desc{"How edge counts are scaled before comparing them"},
+    cl::values(clEnumValN(Normalization::None, "none", "Raw call counts"),
+               clEnumValN(Normalization::Total,
+                          "total",
+                          "Fraction of all calls in the profile"),
+               clEnumValN(Normalization::Root,
+                          "root",
+                          "Calls per invocation of the -root function")),
+    cl::init(Normalization::Total),
+    cl::sub(diffCommand)};
+
+static cl::opt<string> rootName{
+    "root",
+    cl::desc{"Function to normalize by when -normalize=root"},
+    cl::init("main"),
+    cl::sub(diffCommand)};
+
+enum class Ranking { Absolute, Relative };
+
+static cl::opt<Ranking> ranking{
+    "rank",
+    cl::desc{"How changed edges are ordered"},
+    cl::values(clEnumValN(Ranking::Absolute, "abs", "By absolute change"),
+               clEnumValN(Ranking::Relative, "rel", "By relative change")),
+    cl::init(Ranking::Absolute),
+    cl::sub(diffCommand)};
+
+static cl::opt<unsigned> maxLineDrift{
+    "max-line-drift",
+    cl::desc{"Pair otherwise unmatched call sites of the same caller and "
+             "callee whose lines differ by at most this much"},
+    cl::init(10),
+    cl::sub(diffCommand)};
+
+static cl::opt<unsigned> topEdges{
+    "top",
+    cl::desc{"Number of edges to report; 0 reports every edge"},
+    cl::init(50),
+    cl::sub(diffCommand)};
+
+
+namespace {
+
+struct EdgeChange {
+  EdgeMatch sites;
+  double before;
+  double after;
+
+  double
+  absolute() const {
+    return after - before;
+  }
+
+  double
+  relative() const {
+    if (before == 0) {
+      return std::numeric_limits<double>::infinity();
+    }
+    return (after - before) / before;
+  }
+};
+
+}  // namespace
+
+
+// The number of times the root ran. A root that is never called from
+// instrumented code, like main, is scaled by the calls made from it instead.
+static uint64_t
+rootCalls(const Profile& profile, uint32_t root) {
+  uint64_t calls = 0;
+  for (auto& edge : profile.edges) {
+    calls += edge.callee == root ? edge.count : 0;
+  }
+  if (calls != 0) {
+    return calls;
+  }
+  for (auto& edge : profile.edges) {
+    calls += edge.caller == root ? edge.count : 0;
+  }
+  return calls;
+}
+
+
+static double
+scaleFor(const Profile& profile, const StringTable& strings) {
+  uint64_t calls = 0;
+  switch (normalization) {
+    case Normalization::None: return 1;
+    case Normalization::Total: calls = profile.totalCalls(); break;
+    case Normalization::Root:
+      auto root = strings.lookup(rootName);
+      calls = root == StringTable::NOT_FOUND ? 0 : rootCalls(profile, root);
+      break;
+  }
+  return calls == 0 ? 0 : 1.0 / calls;
+}
+
+
+static vector<EdgeChange>
+compareProfiles(const Profile& before,
+                double beforeScale,
+                const Profile& after,
+                double afterScale) {
+  vector<EdgeChange> changes;
+  for (auto& match : cgprofiler::matchProfiles(before, after, maxLineDrift)) {
+    auto old  = match.before ? match.before->count * beforeScale : 0;
+    auto next = match.after ? match.after->count * afterScale : 0;
+    changes.push_back({match, old, next});
+  }
+  return changes;
+}
+
+
+static double
+rankKey(const EdgeChange& change) {
+  return std::fabs(ranking == Ranking::Absolute ? change.absolute()
+                                                : change.relative());
+}
+
+
+int
+runDiff() {
+  StringTable strings;
+  auto before = cgprofiler::readProfile(oldPath, strings);
+  if (!before) {
+    errs() << "Error reading profile " << oldPath << ": "
+           << before.getError().message() << "\n";
+    return -1;
+  }
+  auto after = cgprofiler::readProfile(newPath, strings);
+  if (!after) {
+    errs() << "Error reading profile " << newPath << ": "
+           << after.getError().message() << "\n";
+    return -1;
+  }
+
+  warnIfPartial(oldPath, *before);
+  warnIfPartial(newPath, *after);
+  before->canonicalize();
+  after->canonicalize();
+  auto beforeScale = scaleFor(*before, strings);
+  auto afterScale  = scaleFor(*after, strings);
+  if (normalization == Normalization::Root
+      && (beforeScale == 0 || afterScale == 0)) {
+    errs() << "Root function " << rootName << " makes no calls in one of the "
+           << "profiles.\n";
+    return -1;
+  }
+
+  auto changes = compareProfiles(*before, beforeScale, *after, afterScale);
+  changes.erase(std::remove_if(changes.begin(),
+                               changes.end(),
+                               [](const EdgeChange& change) {
+                                 return change.absolute() == 0;
+                               }),
+                changes.end());
+
+  auto shown = topEdges == 0 ? changes.size()
+                             : std::min<size_t>(topEdges, changes.size());
+  std::partial_sort(changes.begin(),
+                    changes.begin() + shown,
+                    changes.end(),
+                    [](const EdgeChange& a, const EdgeChange& b) {
+                      return rankKey(a) > rankKey(b);
+                    });
+
+  outs() << "caller file line callee old new abs-change rel-change\n";
+  for (auto it = changes.begin(); it != changes.begin() + shown; ++it) {
+    auto& sites = it->sites;
+    auto& site  = sites.after ? *sites.after : *sites.before;
+    outs() << strings.get(site.caller) << " " << strings.get(site.filename)
+           << " ";
+    if (sites.before && sites.after && sites.before->line != site.line) {
+      outs() << sites.before->line << "->";
+    }
+    outs() << site.line << " " << strings.get(site.callee) << " "
+           << format("%.6g %.6g %+.6g ", it->before, it->after, it->absolute());
+    if (it->before == 0) {
+      outs() << "new\n";
+    } else {
+      outs() << format("%+.2f%%\n", 100 * it->relative());
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef CALLPROFILER_SUBCOMMANDS_H
+#define CALLPROFILER_SUBCOMMANDS_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Profile.h"
+
+
+// Subcommands that operate on profiles collected from instrumented programs.
+extern llvm::cl::SubCommand diffCommand;
+int runDiff();
+
+extern llvm::cl::SubCommand analyzeCommand;
+int runAnalyze();
+
+// Warns when a profile does not cover every call of the program, because it
+// was not finalized or because its counter table filled up.
+inline void
+warnIfPartial(llvm::StringRef path, const cgprofiler::Profile& profile) {
+  if (!profile.complete) {
+    llvm::errs() << "Warning: " << path << " was not finalized; the profiled "
+                 << "program may have crashed.\n";
+  }
+  if (profile.dropped) {
+    llvm::errs() << "Warning: " << path << " is missing " << profile.dropped
+                 << " calls that did not fit in its counter table.\n";
+  }
+}
+
+#endif
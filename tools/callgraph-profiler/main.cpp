@@ -19,6 +19,7 @@
 #include "llvm/Pass.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/ManagedStatic.h"
@@ -33,12 +34,21 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetSubtargetInfo.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/Transforms/Scalar.h"
 
+#include <chrono>
 #include <memory>
 #include <string>
+#include <utility>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 
 #include "ProfilingInstrumentationPass.h"
+#include "Subcommands.h"
 
 #include "config.h"
 
@@ -68,6 +78,69 @@ static cl::opt<string> outFile{"o",
                                cl::Required,
                                cl::cat{callProfilerCategory}};
 
+static cl::opt<bool> compileOnly{
+    "c",
+    cl::desc{"Only emit an instrumented object file. Objects instrumented "
+             "separately may be linked together with the runtime later."},
+    cl::init(false),
+    cl::cat{callProfilerCategory}};
+
+static cl::opt<bool> calleeCounting{
+    "callee-counting",
+    cl::desc{"Count calls in the prologue of the callee. Call sites only "
+             "store a site descriptor, which keeps instrumented code small."},
+    cl::init(false),
+    cl::cat{callProfilerCategory}};
+
+static cl::opt<bool> afterInlining{
+    "instrument-after-inlining",
+    cl::desc{"Run the -O2 pipeline, including inlining, before instrumenting. "
+             "Inlined calls are recovered from debug info and still counted."},
+    cl::init(false),
+    cl::cat{callProfilerCategory}};
+
+static cl::opt<unsigned> counterWidth{
+    "counter-width",
+    cl::desc{"Width of the runtime's call counters in bits, 32 or 64"},
+    cl::init(64),
+    cl::cat{callProfilerCategory}};
+
+static cl::opt<bool> atomicCounters{
+    "atomic-counters",
+    cl::desc{"Link a runtime that counts with atomic operations, for "
+             "programs that make calls from several threads"},
+    cl::init(false),
+    cl::cat{callProfilerCategory}};
+
+static cl::opt<bool> sampled{
+    "sampled",
+    cl::desc{"Link a runtime that counts one call in every 64 on each thread "
+             "and scales the counts it reports"},
+    cl::init(false),
+    cl::cat{callProfilerCategory}};
+
+static cl::opt<bool> crashResilient{
+    "crash-resilient",
+    cl::desc{"Link a runtime that counts into a memory mapped file, so the "
+             "profile survives a crash"},
+    cl::init(false),
+    cl::cat{callProfilerCategory}};
+
+static cl::opt<bool> timePhases{
+    "time-phases",
+    cl::desc{"Report the time spent in each phase and the peak memory use "
+             "as CSV on stderr"},
+    cl::init(false),
+    cl::cat{callProfilerCategory}};
+
+static cl::opt<bool> writeStats{
+    "stats",
+    cl::desc{"Write instrumentation statistics as JSON next to the output, "
+             "in <output>.callcounter.stats.json, and link a runtime that "
+             "writes its own"},
+    cl::init(false),
+    cl::cat{callProfilerCategory}};
+
 static cl::opt<char> optLevel{
     "O",
     cl::desc{"Optimization level. [-O0, -O1, -O2, or -O3] (default = '-O2')"},
@@ -89,6 +162,81 @@ static cl::list<string> libraries{"l",
                                   cl::cat{callProfilerCategory}};
 
 
+static vector<std::pair<string, double>> phaseTimes;
+
+
+template <typename Phase>
+static void
+timePhase(StringRef name, Phase&& phase) {
+  auto start = std::chrono::steady_clock::now();
+  phase();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  phaseTimes.emplace_back(name.str(), elapsed.count());
+}
+
+
+static long
+peakRssKb() {
+#ifndef _WIN32
+  struct rusage usage;
+  if (0 == getrusage(RUSAGE_SELF, &usage)) {
+    return usage.ru_maxrss;
+  }
+#endif
+  return -1;
+}
+
+
+static void
+reportPhases() {
+  errs() << "phase,value\n";
+  for (auto& phase : phaseTimes) {
+    errs() << phase.first << "," << format("%.6f", phase.second) << "\n";
+  }
+  auto peak = peakRssKb();
+  if (peak >= 0) {
+    errs() << "peak-rss-kb," << peak << "\n";
+  }
+}
+
+
+static void
+printSeconds(raw_ostream& out,
+             const vector<std::pair<string, double>>& phases) {
+  out << "{";
+  for (auto& phase : phases) {
+    out << (&phase == &phases.front() ? "" : ", ") << "\"" << phase.first
+        << "\": " << format("%.6f", phase.second);
+  }
+  out << "}";
+}
+
+
+static void
+saveStats(const cgprofiler::InstrumentationStats& stats, StringRef filename) {
+  std::error_code errc;
+  raw_fd_ostream out(filename.data(), errc, sys::fs::F_Text);
+  if (errc) {
+    report_fatal_error("error saving statistics to '" + filename + "': \n"
+                       + errc.message());
+  }
+
+  out << "{\n"
+      << "  \"direct_sites\": " << stats.direct_sites << ",\n"
+      << "  \"indirect_sites\": " << stats.indirect_sites << ",\n"
+      << "  \"inlined_sites\": " << stats.inlined_sites << ",\n"
+      << "  \"skipped_sites\": " << stats.skipped_sites << ",\n"
+      << "  \"prologues\": " << stats.prologues << ",\n"
+      << "  \"emitted_globals\": " << stats.emitted_globals << ",\n"
+      << "  \"pass_seconds\": ";
+  printSeconds(out, stats.phase_seconds);
+  out << ",\n  \"driver_seconds\": ";
+  printSeconds(out, phaseTimes);
+  out << ",\n  \"peak_rss_kb\": " << peakRssKb() << "\n}\n";
+}
+
+
 static void
 compile(Module& m, StringRef outputPath) {
   string err;
@@ -231,6 +379,30 @@ saveModule(Module& m, StringRef filename) {
 }
 
 
+// Each combination of runtime policies is built as its own library. The
+// suffixes must match lib/callgraph-profiler-rt/CMakeLists.txt.
+static string
+runtimeLibrary() {
+  string name = RUNTIME_LIB;
+  if (counterWidth == 32) {
+    name += "-c32";
+  }
+  if (atomicCounters) {
+    name += "-atomic";
+  }
+  if (sampled) {
+    name += "-sampled";
+  }
+  if (crashResilient) {
+    name += "-mmap";
+  }
+  if (writeStats) {
+    name += "-stats";
+  }
+  return name;
+}
+
+
 static void
 prepareLinkingPaths(SmallString<32> invocationPath) {
   // First search the directory of the binary for the library, in case it is
@@ -252,13 +424,51 @@ prepareLinkingPaths(SmallString<32> invocationPath) {
   libPaths.push_back(TEMP_LIBRARY_PATH "/Debug/lib/");
   libPaths.push_back(TEMP_LIBRARY_PATH "/Release/lib/");
 #endif
-  libraries.push_back(RUNTIME_LIB);
+  libraries.push_back(runtimeLibrary());
 #ifndef __APPLE__
   libraries.push_back("rt");
 #endif
 }
 
 
+// Gives the module the shape of a release build before it is instrumented, so
+// that calls into the runtime do not change what gets inlined. Loops are
+// unrolled only after instrumentation, since unrolled copies of an inlined
+// body share its location and could not be told apart.
+static void
+optimize(Module& m) {
+  PassManagerBuilder builder;
+  builder.OptLevel    = 2;
+  builder.Inliner     = createFunctionInliningPass(2, 0);
+  builder.LibraryInfo = new TargetLibraryInfoImpl(Triple(m.getTargetTriple()));
+  builder.DisableUnrollLoops = true;
+
+  legacy::FunctionPassManager fpm(&m);
+  builder.populateFunctionPassManager(fpm);
+  fpm.doInitialization();
+  for (auto& f : m) {
+    fpm.run(f);
+  }
+  fpm.doFinalization();
+
+  legacy::PassManager pm;
+  builder.populateModulePassManager(pm);
+  pm.run(m);
+}
+
+
+// Unrolls the loops that optimize() left alone, copying the counts inside
+// them along with everything else.
+static void
+unroll(Module& m) {
+  legacy::PassManager pm;
+  pm.add(createLoopUnrollPass());
+  pm.add(createInstructionCombiningPass());
+  pm.add(createCFGSimplificationPass());
+  pm.run(m);
+}
+
+
 static void
 instrumentForDynamicCount(Module& m) {
   InitializeAllTargets();
@@ -272,14 +482,41 @@ instrumentForDynamicCount(Module& m) {
     exit(-1);
   }
 
-  // Build up all of the passes that we want to run on the module.
-  legacy::PassManager pm;
-  pm.add(new cgprofiler::ProfilingInstrumentationPass());
-  pm.add(createVerifierPass());
-  pm.run(m);
+  // Build up all of the passes that we want to run on the module. They run
+  // as separate phases so that each can be timed on its own.
+  cgprofiler::InstrumentationStats stats;
+  if (afterInlining) {
+    timePhase("optimize", [&m] { optimize(m); });
+  }
+  timePhase("instrument", [&m, &stats] {
+    legacy::PassManager pm;
+    auto* pass = new cgprofiler::ProfilingInstrumentationPass(calleeCounting,
+                                                              afterInlining);
+    pm.add(pass);
+    pm.run(m);
+    stats = pass->stats;
+  });
+  if (afterInlining) {
+    timePhase("unroll", [&m] { unroll(m); });
+  }
+  timePhase("verify", [&m] {
+    legacy::PassManager pm;
+    pm.add(createVerifierPass());
+    pm.run(m);
+  });
 
-  generateBinary(m, outFile);
-  saveModule(m, outFile + ".callcounter.bc");
+  timePhase("codegen", [&m] {
+    if (compileOnly) {
+      compile(m, outFile);
+    } else {
+      generateBinary(m, outFile);
+    }
+  });
+  timePhase("save", [&m] { saveModule(m, outFile + ".callcounter.bc"); });
+
+  if (writeStats) {
+    saveStats(stats, outFile + ".callcounter.stats.json");
+  }
 }
 
 
@@ -294,10 +531,25 @@ main(int argc, char** argv) {
   cl::HideUnrelatedOptions(callProfilerCategory);
   cl::ParseCommandLineOptions(argc, argv);
 
+  if (diffCommand) {
+    return runDiff();
+  }
+  if (analyzeCommand) {
+    return runAnalyze();
+  }
+
+  if (counterWidth != 32 && counterWidth != 64) {
+    errs() << "-counter-width must be 32 or 64.\n";
+    return -1;
+  }
+
   // Construct an IR file from the filename passed on the command line.
   SMDiagnostic err;
   LLVMContext context;
-  unique_ptr<Module> module = parseIRFile(inPath.getValue(), err, context);
+  unique_ptr<Module> module;
+  timePhase("parse", [&] {
+    module = parseIRFile(inPath.getValue(), err, context);
+  });
 
   if (!module.get()) {
     errs() << "Error reading bitcode file: " << inPath << "\n";
@@ -308,5 +560,9 @@ main(int argc, char** argv) {
   prepareLinkingPaths(StringRef(argv[0]));
   instrumentForDynamicCount(*module);
 
+  if (timePhases) {
+    reportPhases();
+  }
+
   return 0;
 }